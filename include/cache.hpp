@@ -1,26 +1,106 @@
+#ifndef YANDEX_MEMCACHED_CACHE_HPP
+#define YANDEX_MEMCACHED_CACHE_HPP
+
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <sstream>
 #include <ctime>
+#include <algorithm>
 
 #include <boost/format.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/assign.hpp>
 #include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include <libmemcached/memcached.h>
 #include <libmemcached/util/pool.h>
 
 #include <log4cxx/logger.h>
 
+#include "keys.hpp"
+#include "errors.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "hotkeys.hpp"
+#include "policy.hpp"
+#include "health.hpp"
+
 namespace yandex { namespace memcached {
     typedef std::vector<std::string> cache_vector_t;
     typedef std::map<std::string, std::string> cache_map_t;
     typedef std::map<std::string, cache_map_t> stats_t;
 
-    typedef boost::function<memcached_return_t
-            (memcached_st*, const char*, size_t, const char*, size_t, time_t, uint32_t)> store_fn_t;
+    typedef std::pair<std::string, uint64_t> cas_value_t;
+    typedef std::map<std::string, cas_value_t> cas_map_t;
+
+    typedef std::vector<std::pair<std::string, std::string> > namespaced_vector_t;
+    typedef std::map<std::string, uint64_t> versions_t;
+    typedef std::map<std::string, uint64_t> counters_t;
+
+    typedef boost::function<void
+            (const std::string&, const char*, size_t, uint32_t, uint64_t)> fetch_fn_t;
+
+    // The libmemcached commands are passed around as plain pointers, the rest
+    // of the operations on the connections are template parameters
+    typedef memcached_return_t (*store_fn_t)
+            (memcached_st*, const char*, size_t, const char*, size_t, time_t, uint32_t);
+    typedef memcached_return_t (*arithmetic_fn_t)
+            (memcached_st*, const char*, size_t, uint32_t, uint64_t*);
+    typedef memcached_return_t (*arithmetic_initial_fn_t)
+            (memcached_st*, const char*, size_t, uint64_t, uint64_t, time_t, uint64_t*);
+
+    namespace flags {
+        // The lower bits hold the inflated length of compressed values, and
+        // the upper ones are reserved for the item type markers
+        const uint32_t length_mask = 0x0fffffff;
+        const uint32_t chunked = 0x80000000;
+
+        // These are left for the value codecs, opaque to the client, which only
+        // stores them along with the items and passes them back on fetches
+        const uint32_t codec_mask = 0x30000000;
+    }
+
+    // Caller-owned storage for Client::get_into(), which keeps its memory from call to call,
+    // so polling a key doesn't allocate once the buffers have grown to fit the value
+    class value_buffer: private boost::noncopyable {
+        public:
+            value_buffer();
+            ~value_buffer();
+
+            inline const char* data() const {
+                return m_value.data();
+            }
+
+            inline size_t length() const {
+                return m_value.length();
+            }
+
+            inline uint32_t codec() const {
+                return m_codec;
+            }
+
+            inline const std::string& value() const {
+                return m_value;
+            }
+
+        private:
+            friend class Client;
+
+            // The result only needs a handle for its allocator, so it gets one of its own
+            // instead of depending on the pooled connections
+            memcached_st m_memcached;
+            memcached_result_st m_result;
+
+            std::string m_value;
+            uint32_t m_codec;
+    };
 
     struct Config {
         public:
@@ -33,6 +113,49 @@ namespace yandex { namespace memcached {
                 uint32_t threshold;
             } compression;
 
+            struct {
+                uint32_t size;
+            } chunking;
+
+            struct {
+                time_t ttl;
+            } namespaces;
+
+            struct {
+                bool hashing;
+            } keys;
+
+            struct {
+                uint32_t factor;
+            } replication;
+
+            struct {
+                uint32_t limit;
+                uint32_t batch;
+                uint32_t delay;
+                uint32_t wait;
+            } write_behind;
+
+            struct {
+                uint32_t interval;
+            } stats;
+
+            struct {
+                uint32_t window;
+                uint32_t size;
+            } batching;
+
+            struct {
+                uint32_t capacity;
+                uint32_t sample;
+            } hot_keys;
+
+            struct {
+                uint32_t interval;
+                uint32_t timeout;
+                uint32_t failures;
+            } health;
+
             double locality;
 
             struct {
@@ -48,6 +171,46 @@ namespace yandex { namespace memcached {
                 // Disable compression
                 compression.threshold = std::numeric_limits<uint32_t>::max();
 
+                // Disable chunking
+                chunking.size = 0;
+
+                // Namespace versions are cached for a second
+                namespaces.ttl = 1;
+
+                // Illegal keys are passed to the server as they are
+                keys.hashing = false;
+
+                // A single copy of every item
+                replication.factor = 1;
+
+                // No write-behind, otherwise the pending writes are flushed in batches
+                // or every few milliseconds, and a write to a full queue waits for the
+                // room for the given number of milliseconds before being dropped
+                write_behind.limit = 0;
+                write_behind.batch = 128;
+                write_behind.delay = 10;
+                write_behind.wait = 0;
+
+                // No background sampling of the server stats, otherwise it's done
+                // every given number of seconds
+                stats.interval = 0;
+
+                // No batching, otherwise the concurrent single-key gets are gathered for
+                // up to the given number of microseconds, or keys, and sent as one mget
+                batching.window = 0;
+                batching.size = 64;
+
+                // No hot key tracking, otherwise up to the given number of keys is
+                // tracked, counting every 16th access to them
+                hot_keys.capacity = 0;
+                hot_keys.sample = 16;
+
+                // No health probing, otherwise every server is probed every given number
+                // of milliseconds, and is marked down after a few failed probes in a row
+                health.interval = 0;
+                health.timeout = 50;
+                health.failures = 2;
+
                 // Initial locality
                 locality = 0.0;
 
@@ -62,62 +225,433 @@ namespace yandex { namespace memcached {
             explicit Client(const std::vector<std::string>& servers);
             ~Client();
 
+            // Besides the global settings, the namespaces get their own policies with options like
+            // 'policy:sessions:expiration-minimum', see policy.hpp. Settings of a namespace which aren't
+            // given explicitly follow the global ones
             void configure(const std::map<std::string, uint64_t>& config);
 
             inline double locality() {
                 return m_config.locality;
             }
 
-            std::string get(const std::string& key);
+            // Timeouts are in milliseconds, and bound the whole call rather than every
+            // socket operation; zero means the configured server timeouts only
+            std::string get(const std::string& key, uint32_t timeout = 0);
             cache_map_t get_multi(const cache_vector_t& keys);
+
+            // Keys which are still pending when the time is up are treated as misses
+            // and listed in 'timedout', the values which have arrived are returned
+            cache_map_t get_multi(const cache_vector_t& keys, uint32_t timeout, cache_vector_t& timedout);
+
+            // These pass the values to the callback right from the fetched or decompressed
+            // buffers, which are only valid for the duration of the call
+            void get(const std::string& key, fetch_fn_t fetch_fn, uint32_t timeout = 0);
+
+            // Receives and decompresses the value right into the buffer, returning false on a miss
+            bool get_into(const std::string& key, value_buffer& buffer, uint32_t timeout = 0);
+
+            // These return false when a server has failed or the time has run out, and
+            // so the keys which haven't been passed on might not be misses after all
+            inline bool get_multi(const cache_vector_t& keys, fetch_fn_t fetch_fn) {
+                return fetch(keys, fetch_fn);
+            }
+
+            inline bool get_multi(const cache_vector_t& keys, fetch_fn_t fetch_fn, uint32_t timeout,
+                cache_vector_t& timedout)
+            {
+                return fetch(keys, fetch_fn, timeout, &timedout);
+            }
             
-            inline bool set(const std::string& key, const std::string& value, time_t expire = 0) {
-                return store(memcached_set, key, value, expire);
+            inline bool set(const std::string& key, const std::string& value, time_t expire = 0, uint32_t codec = 0,
+                uint32_t timeout = 0)
+            {
+                return store(memcached_set, key, value, expire, codec, true, timeout);
+            }
+
+            inline void set_multi(cache_map_t& cache_map, time_t expire = 0, uint32_t codec = 0,
+                uint32_t timeout = 0)
+            {
+                store(memcached_set, cache_map, expire, codec, true, timeout);
+            }
+
+            // Fire-and-forget sets, which are queued for the background thread when write-behind
+            // is enabled, replacing the pending writes to the same keys. False is returned when
+            // the write has been dropped, and the dropped items are left in the map. Pending
+            // writes are seen by the reads, and are settled before any other write to their keys
+            bool set_async(const std::string& key, const std::string& value, time_t expire = 0, uint32_t codec = 0);
+            void set_multi_async(cache_map_t& cache_map, time_t expire = 0, uint32_t codec = 0);
+
+            // Blocks until the writes queued so far have been sent
+            void flush_writes();
+            counters_t get_write_stats();
+
+            // Batches of the single-key gets, when batching is enabled: the number of
+            // batches by size, rounded down to a power of two, and the time the callers
+            // have spent waiting for the batches to be sent, in microseconds
+            counters_t get_batch_stats();
+
+            inline bool add(const std::string& key, const std::string& value, time_t expire = 0, uint32_t codec = 0,
+                uint32_t timeout = 0)
+            {
+                return store(memcached_add, key, value, expire, codec, true, timeout);
+            }
+
+            inline void add_multi(cache_map_t& cache_map, time_t expire = 0, uint32_t codec = 0,
+                uint32_t timeout = 0)
+            {
+                store(memcached_add, cache_map, expire, codec, true, timeout);
+            }
+
+            inline bool replace(const std::string& key, const std::string& value, time_t expire = 0, uint32_t codec = 0,
+                uint32_t timeout = 0)
+            {
+                return store(memcached_replace, key, value, expire, codec, true, timeout);
+            }
+
+            inline void replace_multi(cache_map_t& cache_map, time_t expire = 0, uint32_t codec = 0,
+                uint32_t timeout = 0)
+            {
+                store(memcached_replace, cache_map, expire, codec, true, timeout);
+            }
+
+            // The appended data is never compressed, as memcached keeps the original
+            // item flags: items meant to be appended to have to be stored below the
+            // compression threshold. Appending to a compressed item makes it fail
+            // the decompression, so it's read back as a miss, and never as garbage
+            inline bool append(const std::string& key, const std::string& value) {
+                return store(memcached_append, key, value, 0, 0, false);
             }
 
-            inline void set_multi(cache_map_t& cache_map, time_t expire = 0) {
-                store(memcached_set, cache_map, expire);
+            inline void append_multi(cache_map_t& cache_map) {
+                store(memcached_append, cache_map, 0, 0, false);
             }
 
-            inline bool add(const std::string& key, const std::string& value, time_t expire = 0) {
-                return store(memcached_add, key, value, expire);
+            inline bool prepend(const std::string& key, const std::string& value) {
+                return store(memcached_prepend, key, value, 0, 0, false);
             }
 
-            inline void add_multi(cache_map_t& cache_map, time_t expire = 0) {
-                store(memcached_add, cache_map, expire);
+            inline void prepend_multi(cache_map_t& cache_map) {
+                store(memcached_prepend, cache_map, 0, 0, false);
             }
 
-            inline bool replace(const std::string& key, const std::string& value, time_t expire = 0) {
-                return store(memcached_replace, key, value, expire);
+            // Values come with their CAS tokens, which are only filled in when
+            // either the binary protocol or the 'support-cas' behavior is enabled
+            cas_value_t gets(const std::string& key);
+            cas_map_t gets_multi(const cache_vector_t& keys);
+
+            // Settles the pending writes to the keys first, as the plain gets do
+            void gets_multi(const cache_vector_t& keys, fetch_fn_t fetch_fn);
+
+            bool cas(const std::string& key, const std::string& value, uint64_t cas, time_t expire = 0,
+                uint32_t codec = 0);
+            void cas_multi(cas_map_t& cas_map, time_t expire = 0, uint32_t codec = 0);
+
+            // Deltas which don't fit in 32 bits are only supported by the binary protocol
+            inline bool incr(const std::string& key, uint64_t delta, uint64_t& value) {
+                return arithmetic(memcached_increment, key, delta, value);
+            }
+
+            inline bool decr(const std::string& key, uint64_t delta, uint64_t& value) {
+                return arithmetic(memcached_decrement, key, delta, value);
             }
 
-            inline void replace_multi(cache_map_t& cache_map, time_t expire = 0) {
-                store(memcached_replace, cache_map, expire);
+            // These create the counter with the initial value if it doesn't exist,
+            // which is only supported by the binary protocol
+            inline bool incr(const std::string& key, uint64_t delta, uint64_t initial, uint64_t& value, time_t expire = 0) {
+                return arithmetic(memcached_increment_with_initial, key, delta, initial, value, expire);
+            }
+
+            inline bool decr(const std::string& key, uint64_t delta, uint64_t initial, uint64_t& value, time_t expire = 0) {
+                return arithmetic(memcached_decrement_with_initial, key, delta, initial, value, expire);
             }
             
+            // Extends the item lifetime without sending the value over again. With chunking
+            // enabled, the values are fetched first, for the chunks to be touched as well
+            bool touch(const std::string& key, time_t expire = 0);
+            void touch_multi(cache_vector_t& cache_vector, time_t expire = 0);
+
+            // The expiration is passed on as it is, like the GAT command does, so zero makes the
+            // item permanent rather than getting it the default expiration. libmemcached has no
+            // GAT, so this is a touch and then a get, which is two round trips and not atomic
+            std::string get_and_touch(const std::string& key, time_t expire = 0);
+            void get_and_touch(const std::string& key, time_t expire, fetch_fn_t fetch_fn);
+
             bool remove(const std::string& key);
             void remove_multi(cache_vector_t& cache_vector);
             void flush();
 
             stats_t get_stats();
 
+            // Positions of the servers the keys are hashed to, with the current hashing
+            // configuration, in the order of get_servers(), which lists them as 'host:port'
+            void locate(const cache_vector_t& keys, std::vector<uint32_t>& result);
+            std::vector<std::string> get_servers() const;
+
+            // The latest sample taken by the background collector, which costs nothing
+            // to get, or an empty pointer when the collection isn't configured
+            cluster_stats_ptr get_cluster_stats() const;
+
+            // Failures counted since the client was created, by server and by reason
+            errors_t get_errors() const;
+
+            // Records every operation into a binary trace file, see trace.hpp, until stopped.
+            // Records which don't fit into the ring of the given capacity are dropped
+            inline bool start_trace(const std::string& path, uint32_t capacity = 65536) {
+                return m_tracer.start(path, capacity);
+            }
+
+            inline void stop_trace() {
+                m_tracer.stop();
+            }
+
+            inline uint64_t get_trace_dropped() const {
+                return m_tracer.dropped();
+            }
+
+            // Server states, when 'health-interval' is configured. While a server is marked down,
+            // the requests to its keys fail fast, and the reads go to the copies, if any. The
+            // callbacks are run from the prober thread on every transition
+            void on_health_change(health_fn_t health_fn);
+            std::map<std::string, bool> get_health() const;
+            counters_t get_health_stats() const;
+
+            // Snapshots of the most accessed keys, which are tracked when 'hot-keys' is configured.
+            // Once a path is given, the snapshot is saved there when the client is destroyed,
+            // and every given number of seconds, if any
+            bool save_hot_keys(const std::string& path) const;
+            void snapshot_hot_keys(const std::string& path, uint32_t interval = 0);
+
+            // Prefetches the keys of a snapshot with multigets of the given size, passing the values
+            // to the callback, so that the local caches are filled before taking traffic. Returns
+            // the number of the values found
+            size_t warm(const std::string& path, fetch_fn_t fetch_fn, uint32_t chunk = 256);
+
+            // Namespaced keys are composed as 'namespace:vN:key', where N is the namespace
+            // version, which is stored in the cache and looked up at most once per TTL, so
+            // that the whole namespace is invalidated by bumping it. When the version can't be
+            // looked up, a random one is used for a second, so the keys miss rather than collide
+            std::string namespaced_key(const std::string& ns, const std::string& key);
+            cache_vector_t namespaced_keys(const namespaced_vector_t& keys);
+            versions_t namespace_versions(const cache_vector_t& namespaces);
+            bool invalidate_namespace(const std::string& ns);
+
             template<typename K>
             inline std::string compose_key(const std::string& prefix, const K key) const {
-                std::ostringstream result;
+                key_builder result;
 
                 result << prefix << ':' << key;
                 return result.str();
             }
        
         private:
-            bool store(store_fn_t store_fn, const std::string& key, const std::string& value, time_t expire);
-            void store(store_fn_t store_fn, cache_map_t& cache_map, time_t expire);
+            struct chunked_value;
+            struct deadline;
+            struct buffer_collector;
+            struct get_batch;
+
+            bool fetch(const cache_vector_t& keys, fetch_fn_t fetch_fn, uint32_t timeout = 0,
+                cache_vector_t* timedout = NULL);
+            void assemble(memcached_st* connection, std::vector<chunked_value>& pending, fetch_fn_t fetch_fn,
+                deadline& limit);
+
+            // A single-key get into the given result, through the server of the routing key
+            memcached_return_t receive(memcached_st* connection, const std::string& route, const std::string& key,
+                memcached_result_st* result);
+
+            // Requests for the unanswered keys, grouped by the servers holding their copies of the given rank
+            void fallback(const memcached_st* connection, const policy_table& table, const cache_vector_t& keys,
+                const std::set<std::string>& answered, uint32_t rank, std::map<uint32_t, std::pair<std::string, cache_vector_t> >& requests) const;
+
+            bool store(store_fn_t store_fn, const std::string& key, const std::string& value, time_t expire,
+                uint32_t codec = 0, bool compressible = true, uint32_t timeout = 0);
+            void store(store_fn_t store_fn, cache_map_t& cache_map, time_t expire, uint32_t codec = 0,
+                bool compressible = true, uint32_t timeout = 0);
+
+            template<typename StoreFn>
+            memcached_return_t put(memcached_st* connection, StoreFn store_fn, const std::string& key, uint32_t factor,
+                const char* data, size_t length, time_t expire, uint32_t flags, deadline* limit = NULL);
+
+            bool arithmetic(arithmetic_fn_t arithmetic_fn, const std::string& key, uint64_t delta, uint64_t& value);
+            bool arithmetic(arithmetic_initial_fn_t arithmetic_fn, const std::string& key, uint64_t delta,
+                uint64_t initial, uint64_t& value, time_t expire);
 
-            boost::format error(const char* function, const memcached_st* connection,
-                memcached_return_t code, const std::string& key = "") const;
+            // Keys which are too long or contain illegal characters are replaced with
+            // their digests when hashing is enabled, and are returned as they are otherwise
+            const std::string& wire_key(const std::string& key, std::string& buffer) const;
+
+            // With replication, every item is also stored on the servers following its primary one,
+            // preferring the servers on other subnets. Copies are addressed with the routing keys,
+            // one per server, so the item keys stay the same on every server
+            void replicas(const memcached_st* connection, const std::string& key, uint32_t factor,
+                std::vector<uint32_t>& result) const;
+            static bool routing_key(const cache_vector_t& routes, uint32_t server, std::string& result);
+
+            // The routing keys route() has published last, taken once per call like the policies
+            inline boost::shared_ptr<const cache_vector_t> routes() const {
+                return boost::atomic_load(&m_routes);
+            }
+
+            // Searches for a key hashed to every server, once the hashing has been set up
+            void route(const memcached_st* connection);
+
+            template<typename ReplicaFn>
+            void replicate(memcached_st* connection, const std::string& key, uint32_t factor, ReplicaFn replica_fn);
+
+            // Reads the key from its copies in turn, after the primary has failed with the given code,
+            // until one of them answers or the deadline passes
+            template<typename ReadFn>
+            memcached_return_t read_replicas(memcached_st* connection, const std::string& key, const std::string& wire,
+                memcached_return_t rc, deadline& limit, ReadFn read_fn);
+
+            // The table configure() has published last. It's replaced as a whole, so the policies
+            // looked up stay valid for as long as the caller holds on to the table, which is
+            // taken once per call and passed down
+            inline boost::shared_ptr<const policy_table> policies() const {
+                return boost::atomic_load(&m_policies);
+            }
+
+            // The replication factor of the namespace of the key, without a lookup when nothing is replicated
+            static inline uint32_t replication(const policy_table& table, const std::string& key) {
+                return table.replication() > 1 ? table.resolve(key).replication_factor : 1;
+            }
+
+            // Write-behind
+            struct pending_write {
+                std::string value;
+                time_t expire;
+                uint32_t codec;
+            };
+
+            typedef std::map<std::string, pending_write> pending_map_t;
+
+            void start_writer();
+            void stop_writer();
+            void write_behind();
+            void write(const pending_map_t& writes, bool pipelined);
+
+            // The items which couldn't be queued are left in the map
+            void queue_writes(const policy_table& table, cache_map_t& cache_map, time_t expire, uint32_t codec);
+
+            // Gathers the get into the current batch, sending the batch when it's the first one there
+            void batched_get(const std::string& key, fetch_fn_t fetch_fn);
+
+            // Health probing
+            void start_prober();
+            void stop_prober();
+            void probe_servers();
+
+            // False when the server of the key is marked down, costing nothing while every server is up
+            inline bool reachable(const memcached_st* connection, const std::string& wire) {
+                return m_health.healthy() || m_health.admit(memcached_generate_hash(connection, wire.data(), wire.length()));
+            }
+
+            // Hot key snapshots
+            void stop_snapshots();
+            void save_snapshots(uint32_t interval);
+
+            // Stats sampling
+            void start_sampler();
+            void stop_sampler();
+            void sample_stats();
+
+            bool read_pending(const std::string& key, fetch_fn_t fetch_fn);
+            const cache_vector_t& read_pending(const cache_vector_t& keys, fetch_fn_t fetch_fn, cache_vector_t& remaining);
+
+            // Writes the pending values of the keys out, or drops them, and waits for the ones in flight.
+            // Never to be called while holding a pooled connection, as the writer needs one to finish
+            void settle(const cache_vector_t& keys, bool discard = false);
+
+            inline void settle(const std::string& key, bool discard = false) {
+                if(m_writer) {
+                    settle(cache_vector_t(1, key), discard);
+                }
+            }
+
+            static inline time_t expiration(const policy_table& table, const std::string& key, time_t expire) {
+                return expire ? expire : table.resolve(key).expiration(expire);
+            }
+
+            // With the exact expiration, zero isn't replaced with the default one
+            void touch_multi(cache_vector_t& cache_vector, time_t expire, bool exact);
+
+            // Counts the failure and logs it, unless it has already been reported
+            // recently, in which case it's left for the next aggregated report
+            void report(const char* function, const memcached_st* connection,
+                memcached_return_t code, const std::string& key = "");
+
+            // Logs the failures left unreported, see error_counters::pending()
+            void report_pending(bool force);
 
             memcached_pool_st* m_pool;
             log4cxx::LoggerPtr m_log;
             Config m_config;
+            error_counters m_errors;
+
+            // Server subnets, by server position
+            std::vector<unsigned long> m_subnets;
+
+            // Routing keys, by server position, replaced as a whole whenever they're searched for
+            boost::shared_ptr<const cache_vector_t> m_routes;
+
+            // Namespace policies, as configured, and the table they're looked up in
+            policy_options_t m_policy_options;
+            boost::shared_ptr<const policy_table> m_policies;
+
+            // Writes waiting for the background thread, and the ones it's sending
+            struct write_counters {
+                write_counters():
+                    queued(0),
+                    coalesced(0),
+                    dropped(0),
+                    flushed(0) {}
+
+                uint64_t queued, coalesced, dropped, flushed;
+            };
+
+            pending_map_t m_pending, m_flushing;
+            write_counters m_write_stats;
+            boost::mutex m_pending_mutex;
+            boost::condition_variable m_wakeup, m_room;
+            boost::scoped_ptr<boost::thread> m_writer;
+            bool m_stopping;
+
+            stats_collector m_stats;
+            boost::scoped_ptr<boost::thread> m_sampler;
+
+            // The batch which is still open for the gets, and the counters of the sent ones
+            struct batch_counters {
+                batch_counters():
+                    calls(0),
+                    keys(0),
+                    waited(0),
+                    longest(0)
+                {
+                    std::fill(sizes, sizes + 32, 0);
+                }
+
+                uint64_t sizes[32];
+                uint64_t calls, keys, waited, longest;
+            };
+
+            boost::shared_ptr<get_batch> m_batch;
+            batch_counters m_batch_stats;
+            boost::mutex m_batch_mutex;
+
+            health_monitor m_health;
+            boost::scoped_ptr<boost::thread> m_prober;
+
+            hot_keys m_hot_keys;
+            std::string m_snapshot_path;
+            boost::scoped_ptr<boost::thread> m_snapshots;
+
+            tracer m_tracer;
+
+            // Namespace version cache
+            typedef std::map<std::string, std::pair<uint64_t, time_t> > namespace_cache_t;
+
+            namespace_cache_t m_namespaces;
+            boost::mutex m_namespaces_mutex;
     };
 }}
+
+#endif
@@ -0,0 +1,97 @@
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/format.hpp>
+
+#include <lzo/lzo1x.h>
+
+#include "keys.hpp"
+
+namespace yandex { namespace helpers {
+    // Values over the chunk size are split into a number of sub-items, and the
+    // original key holds this manifest instead. The chunk keys depend on the
+    // generation, so chunks of different writes never get mixed up
+    struct manifest {
+        public:
+            manifest():
+                m_magic(0),
+                m_count(0),
+                m_chunk(0),
+                m_checksum(0),
+                m_length(0),
+                m_generation(0) {}
+
+            manifest(const char* data, size_t data_length, uint32_t chunk, uint64_t generation):
+                m_magic(signature),
+                m_count((data_length + chunk - 1) / chunk),
+                m_chunk(chunk),
+                m_checksum(lzo_adler32(1, reinterpret_cast<const lzo_bytep>(data), data_length)),
+                m_length(data_length),
+                m_generation(generation) {}
+
+            bool parse(const char* data, size_t data_length) {
+                if(data_length != size) {
+                    return false;
+                }
+
+                memcpy(&m_magic, data, sizeof(m_magic));
+                memcpy(&m_count, data + 4, sizeof(m_count));
+                memcpy(&m_chunk, data + 8, sizeof(m_chunk));
+                memcpy(&m_checksum, data + 12, sizeof(m_checksum));
+                memcpy(&m_length, data + 16, sizeof(m_length));
+                memcpy(&m_generation, data + 24, sizeof(m_generation));
+
+                return (m_magic == signature && m_chunk &&
+                    m_count == (m_length + m_chunk - 1) / m_chunk);
+            }
+
+            std::string serialize() const {
+                char buffer[size];
+
+                memcpy(buffer, &m_magic, sizeof(m_magic));
+                memcpy(buffer + 4, &m_count, sizeof(m_count));
+                memcpy(buffer + 8, &m_chunk, sizeof(m_chunk));
+                memcpy(buffer + 12, &m_checksum, sizeof(m_checksum));
+                memcpy(buffer + 16, &m_length, sizeof(m_length));
+                memcpy(buffer + 24, &m_generation, sizeof(m_generation));
+
+                return std::string(buffer, size);
+            }
+
+            // Always digested, as the suffix can take a legal key over the length limit
+            inline void key(const std::string& key, uint32_t index, std::string& result) const {
+                std::string chunk = (boost::format("%1%:%2$x:%3%") % key % m_generation % index).str();
+                memcached::digest_key(chunk.data(), chunk.length(), result);
+            }
+
+            inline bool verify(const char* data, size_t data_length) const {
+                return (data_length == m_length &&
+                    lzo_adler32(1, reinterpret_cast<const lzo_bytep>(data), data_length) == m_checksum);
+            }
+
+            inline uint32_t count() const {
+                return m_count;
+            }
+
+            inline uint64_t length() const {
+                return m_length;
+            }
+
+            inline size_t offset(uint32_t index) const {
+                return static_cast<size_t>(index) * m_chunk;
+            }
+
+            inline size_t length(uint32_t index) const {
+                return std::min<uint64_t>(m_chunk, m_length - offset(index));
+            }
+
+            static const size_t size = 32;
+
+        private:
+            static const uint32_t signature = 0x434d594c; // "LYMC"
+
+            uint32_t m_magic, m_count, m_chunk, m_checksum;
+            uint64_t m_length, m_generation;
+    };
+}}
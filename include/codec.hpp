@@ -0,0 +1,38 @@
+#ifndef YANDEX_MEMCACHED_CODEC_HPP
+#define YANDEX_MEMCACHED_CODEC_HPP
+
+#include <boost/python.hpp>
+#include <string>
+
+namespace yandex { namespace memcached { namespace python {
+    using namespace boost::python;
+
+    namespace codecs {
+        // Plain strings are stored as they are, with no codec bits set
+        const uint32_t native = 0x10000000;
+        const uint32_t pickled = 0x20000000;
+        const uint32_t integer = 0x30000000;
+    }
+
+    // Serializes the values of common builtin types (None, bool, int, long, float, str,
+    // unicode and exact lists, tuples and dicts of those) into a compact binary form,
+    // falling back to the highest pickle protocol for everything else. Plain ints and
+    // longs are stored as decimal text instead, as python-memcached does, so that they
+    // can be incremented and decremented on the servers. The codec used is returned
+    // as item flags, so decoding never has to guess. Must be called with the GIL held
+    class Codec {
+        public:
+            Codec();
+
+            uint32_t encode(const object& value, std::string& result) const;
+            object decode(const char* data, size_t length, uint32_t flags) const;
+
+        private:
+            bool pack(PyObject* value, std::string& result, int depth) const;
+            PyObject* unpack(const char*& data, const char* end, int depth) const;
+
+            object m_dumps, m_loads;
+    };
+}}}
+
+#endif
@@ -8,6 +8,18 @@ namespace yandex { namespace helpers {
     template<algorithm> struct compressor;
     template<algorithm> struct decompressor;
 
+    // Decompresses straight into the caller's memory, which has to fit the whole value
+    inline bool decompress(const char* data, size_t data_length, char* result, size_t result_length) {
+        lzo_uint length = result_length;
+
+        int ret = lzo1x_decompress_safe(reinterpret_cast<const lzo_bytep>(data), data_length,
+            reinterpret_cast<lzo_bytep>(result), &length, NULL);
+
+        // A length mismatch means that the stream was tampered with, e.g. by
+        // appending raw data to a compressed item
+        return (ret == LZO_E_OK && length == result_length);
+    }
+
     template<> struct compressor<lzo> {
         public:
             compressor():
@@ -65,12 +77,9 @@ namespace yandex { namespace helpers {
                     m_buffer = static_cast<lzo_bytep>(realloc(m_buffer, m_buffer_length));
                 }
 
-                m_result_length = m_buffer_length;
-
-                int ret = lzo1x_decompress_safe(reinterpret_cast<const lzo_bytep>(data), data_length,
-                    m_buffer, &m_result_length, NULL);
+                m_result_length = expansion_length;
 
-                return (ret == LZO_E_OK);
+                return decompress(data, data_length, reinterpret_cast<char*>(m_buffer), expansion_length);
             }
 
             inline const char* data() const {
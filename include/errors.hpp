@@ -0,0 +1,65 @@
+#ifndef YANDEX_MEMCACHED_ERRORS_HPP
+#define YANDEX_MEMCACHED_ERRORS_HPP
+
+#include <string>
+#include <map>
+#include <ctime>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+
+#include <libmemcached/memcached.h>
+
+namespace yandex { namespace memcached {
+    // Failure counts by server and by return code
+    typedef std::map<std::string, std::map<std::string, uint64_t> > errors_t;
+
+    // Failures which haven't been reported yet by server, with the time of the last report
+    typedef std::map<std::string, std::pair<uint64_t, time_t> > pending_errors_t;
+
+    // Lock-free failure counters with a row per server, plus a spare one for the
+    // failures which can't be pinned to a particular server. Only one thread per
+    // server per second gets to report, so during an outage the failures are
+    // logged as aggregates instead of serializing every thread on the logger
+    class error_counters: private boost::noncopyable {
+        public:
+            error_counters();
+
+            // Not thread-safe, has to be called before the client is shared
+            void reset(const memcached_st* memcached);
+
+            // Returns the number of failures on the server since the last report
+            // if the caller should report them now, and zero otherwise
+            uint64_t account(uint32_t server, memcached_return_t code, time_t& since);
+
+            // Takes the failures left over from the bursts which have ended before the next
+            // second, and so were never reported, or all the unreported ones when forced
+            pending_errors_t pending(bool force);
+
+            // The server with the host and the port of the instance, or the unknown one
+            uint32_t find(memcached_server_instance_st instance) const;
+
+            errors_t snapshot() const;
+
+            inline uint32_t unknown() const {
+                return m_count;
+            }
+
+            inline const std::string& name(uint32_t server) const {
+                return m_rows[server < m_count ? server : m_count].name;
+            }
+
+        private:
+            struct row {
+                std::string name;
+                volatile uint64_t codes[MEMCACHED_MAXIMUM_RETURN];
+                volatile uint64_t total, reported;
+                volatile time_t logged;
+            };
+
+            boost::scoped_array<row> m_rows;
+            uint32_t m_count;
+    };
+}}
+
+#endif
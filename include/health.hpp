@@ -0,0 +1,77 @@
+#ifndef YANDEX_MEMCACHED_HEALTH_HPP
+#define YANDEX_MEMCACHED_HEALTH_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <libmemcached/memcached.h>
+
+#include <stdint.h>
+
+namespace yandex { namespace memcached {
+    // Called with the 'host:port' of the server and whether it's up now
+    typedef boost::function<void (const std::string&, bool)> health_fn_t;
+
+    // Server states as seen by the background prober, which pings every server with
+    // a connection of its own. A server is marked down after a number of failed probes
+    // in a row, and up again after the first successful one. The requests to the keys
+    // of the servers which are down fail fast rather than wait for the timeouts
+    class health_monitor: private boost::noncopyable {
+        public:
+            health_monitor();
+            ~health_monitor();
+
+            // Not thread-safe, has to be called before the client is shared
+            void reset(const memcached_st* memcached);
+
+            // Probes every server once, timeout in milliseconds
+            void probe(uint32_t timeout, uint32_t failures);
+
+            // Every server is up, which is all the request path checks in the normal case
+            inline bool healthy() const {
+                return m_down == 0;
+            }
+
+            // Counts the requests turned away from the servers which are down
+            inline bool admit(uint32_t server) {
+                if(server < m_count && m_servers[server].down) {
+                    __sync_fetch_and_add(&m_rejected, 1);
+                    return false;
+                }
+
+                return true;
+            }
+
+            // Called from the prober thread, on every transition
+            void subscribe(health_fn_t health_fn);
+
+            std::map<std::string, bool> snapshot() const;
+            std::map<std::string, uint64_t> counters() const;
+
+        private:
+            struct server {
+                std::string name;
+                memcached_st* probe;
+                uint32_t failures;
+                volatile bool down;
+            };
+
+            boost::scoped_array<server> m_servers;
+            uint32_t m_count;
+            volatile uint32_t m_down;
+
+            uint64_t m_probes, m_failed, m_downs, m_ups;
+            volatile uint64_t m_rejected;
+
+            std::vector<health_fn_t> m_subscribers;
+            mutable boost::mutex m_mutex;
+    };
+}}
+
+#endif
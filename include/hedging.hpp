@@ -0,0 +1,91 @@
+#ifndef YANDEX_MEMCACHED_HEDGING_HPP
+#define YANDEX_MEMCACHED_HEDGING_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "cache.hpp"
+
+namespace yandex { namespace memcached {
+    // Reads from two clients holding the same data. When the primary one hasn't answered
+    // within the given percentile of its recent latencies, or has failed, the keys are
+    // requested from the backup one as well, with the first request still in flight, and
+    // the first complete answer wins. Both requests run on a pool of threads of its own,
+    // which is bounded by the number of the reads and of the hedges in flight: the reads
+    // over the first limit go straight to the primary client, and the ones over the
+    // second limit just wait for it. Delays are in microseconds
+    class hedged_reader: private boost::noncopyable {
+        public:
+            hedged_reader(Client& primary, Client& backup, uint32_t percentile = 95,
+                uint32_t initial_delay = 10000, uint32_t minimum_delay = 1000, uint32_t limit = 8,
+                uint32_t concurrency = 64);
+            ~hedged_reader();
+
+            // Passes the values on in the calling thread, once the race is over. Returns
+            // false when neither client has answered for every key, in which case the
+            // values the primary one has found are passed on
+            bool get_multi(const cache_vector_t& keys, fetch_fn_t fetch_fn);
+
+            counters_t counters() const;
+
+        private:
+            typedef std::map<std::string, std::pair<std::string, uint32_t> > values_t;
+
+            struct race;
+
+            enum leg_t {
+                none,
+                primary_leg,
+                backup_leg
+            };
+
+            void read(boost::shared_ptr<race> state, leg_t leg);
+            void hedge(boost::shared_ptr<race> state);
+
+            // Called with the mutex held
+            void sample(uint64_t latency);
+            void restart();
+
+            // Runs the task on an idle thread, starting one if there's none and the pool isn't full
+            void dispatch(const boost::function<void ()>& task);
+            void work();
+
+            Client& m_primary;
+            Client& m_backup;
+
+            // Latencies of the primary client, and the delay computed from them every so often
+            std::vector<uint64_t> m_samples;
+            size_t m_position;
+            uint64_t m_sampled;
+            uint32_t m_percentile;
+            uint64_t m_delay, m_minimum_delay;
+
+            uint32_t m_limit, m_concurrency;
+            uint32_t m_reading, m_hedging;
+            uint64_t m_reads, m_hedged, m_won, m_suppressed, m_direct;
+            pid_t m_pid;
+            mutable boost::mutex m_mutex;
+
+            // The threads don't survive a fork, so the ones of the parent are forgotten
+            std::vector<boost::thread*> m_threads;
+            std::deque<boost::function<void ()> > m_tasks;
+            uint32_t m_idle;
+            bool m_stopping;
+            boost::mutex m_tasks_mutex;
+            boost::condition_variable m_wakeup;
+    };
+}}
+
+#endif
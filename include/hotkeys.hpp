@@ -0,0 +1,61 @@
+#ifndef YANDEX_MEMCACHED_HOTKEYS_HPP
+#define YANDEX_MEMCACHED_HOTKEYS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <stdint.h>
+
+namespace yandex { namespace memcached {
+    // The snapshot file is a header followed by the keys, hottest first, each one
+    // prefixed with its length, in the byte order of the host
+    struct hot_keys_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t count;
+    };
+
+    const char hot_keys_magic[8] = { 'Y', 'M', 'C', 'H', 'O', 'T', 'K', 'S' };
+    const uint32_t hot_keys_version = 1;
+
+    // Approximate counts of the most accessed keys. Only every so many accesses are
+    // counted, and once the table has grown to twice the capacity, it's cut down to the
+    // capacity, halving the counts and dropping the ones which reach zero, so that the
+    // recent accesses weigh more
+    class hot_keys: private boost::noncopyable {
+        public:
+            hot_keys();
+
+            // The counts are dropped, zero capacity disables the counting
+            void reset(uint32_t capacity, uint32_t sample);
+
+            inline void touch(const std::string& key) {
+                if(m_capacity && __sync_add_and_fetch(&m_seen, 1) % m_sample == 0) {
+                    account(key);
+                }
+            }
+
+            // The hottest keys first
+            std::vector<std::string> top(uint32_t count) const;
+
+            // The snapshot is written next to the file and renamed over it, so
+            // the readers never see a partial one
+            bool save(const std::string& path) const;
+            static bool load(const std::string& path, std::vector<std::string>& keys);
+
+        private:
+            void account(const std::string& key);
+            void prune();
+
+            std::map<std::string, uint64_t> m_counts;
+            uint32_t m_capacity, m_sample;
+            volatile uint64_t m_seen;
+            mutable boost::mutex m_mutex;
+    };
+}}
+
+#endif
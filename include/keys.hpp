@@ -0,0 +1,211 @@
+#ifndef YANDEX_MEMCACHED_KEYS_HPP
+#define YANDEX_MEMCACHED_KEYS_HPP
+
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/type_traits/is_integral.hpp>
+#include <boost/type_traits/is_signed.hpp>
+#include <boost/utility/enable_if.hpp>
+
+#include <stdint.h>
+
+namespace yandex { namespace memcached {
+    // The longest key memcached accepts
+    const size_t max_key_length = 250;
+
+    // Builds the keys on the stack, only going to the heap for the result
+    // or when the key turns out to be too long for the buffer
+    template<size_t N = max_key_length + 1>
+    struct basic_key_builder {
+        public:
+            basic_key_builder():
+                m_length(0) {}
+
+            inline basic_key_builder& operator<<(const std::string& value) {
+                return append(value.data(), value.length());
+            }
+
+            inline basic_key_builder& operator<<(const char* value) {
+                return append(value, strlen(value));
+            }
+
+            inline basic_key_builder& operator<<(char value) {
+                return append(&value, 1);
+            }
+
+            template<typename T>
+            inline typename boost::enable_if<boost::is_integral<T>, basic_key_builder&>::type
+            operator<<(T value) {
+                char buffer[24], *end = buffer + sizeof(buffer), *it = end;
+                bool negative = boost::is_signed<T>::value && value < 0;
+                uint64_t number = negative ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+
+                do {
+                    *--it = '0' + number % 10;
+                    number /= 10;
+                } while(number);
+
+                if(negative) {
+                    *--it = '-';
+                }
+
+                return append(it, end - it);
+            }
+
+            // Everything else goes through the streams, like it used to
+            template<typename T>
+            inline typename boost::disable_if<boost::is_integral<T>, basic_key_builder&>::type
+            operator<<(const T& value) {
+                std::ostringstream stream;
+                stream << value;
+                return *this << stream.str();
+            }
+
+            inline const char* data() const {
+                return m_length <= N ? m_buffer : m_spill.data();
+            }
+
+            inline size_t length() const {
+                return m_length;
+            }
+
+            inline std::string str() const {
+                return std::string(data(), m_length);
+            }
+
+        private:
+            basic_key_builder& append(const char* value, size_t length) {
+                if(m_length + length <= N) {
+                    memcpy(m_buffer + m_length, value, length);
+                } else {
+                    if(m_length <= N) {
+                        m_spill.assign(m_buffer, m_length);
+                    }
+
+                    m_spill.append(value, length);
+                }
+
+                m_length += length;
+                return *this;
+            }
+
+            char m_buffer[N];
+            size_t m_length;
+            std::string m_spill;
+    };
+
+    typedef basic_key_builder<> key_builder;
+
+    // Keys which memcached would reject
+    inline bool is_legal_key(const char* key, size_t length) {
+        if(!length || length > max_key_length) {
+            return false;
+        }
+
+        for(const char* it = key; it != key + length; ++it) {
+            if(static_cast<unsigned char>(*it) <= ' ' || *it == 0x7f) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    namespace detail {
+        inline uint64_t rotl64(uint64_t x, int8_t r) {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        inline uint64_t fmix64(uint64_t k) {
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdULL;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53ULL;
+            k ^= k >> 33;
+            return k;
+        }
+
+        // MurmurHash3_x64_128 by Austin Appleby, which is in the public domain
+        inline void murmur3(const char* key, size_t length, uint64_t& h1, uint64_t& h2) {
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(key);
+            const size_t blocks = length / 16;
+            const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+            uint64_t k1, k2;
+
+            h1 = h2 = 0;
+
+            for(size_t i = 0; i < blocks; ++i) {
+                memcpy(&k1, data + i * 16, 8);
+                memcpy(&k2, data + i * 16 + 8, 8);
+
+                k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+                h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+                k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+                h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+            }
+
+            const uint8_t* tail = data + blocks * 16;
+            k1 = k2 = 0;
+
+            switch(length & 15) {
+                case 15: k2 ^= static_cast<uint64_t>(tail[14]) << 48;
+                case 14: k2 ^= static_cast<uint64_t>(tail[13]) << 40;
+                case 13: k2 ^= static_cast<uint64_t>(tail[12]) << 32;
+                case 12: k2 ^= static_cast<uint64_t>(tail[11]) << 24;
+                case 11: k2 ^= static_cast<uint64_t>(tail[10]) << 16;
+                case 10: k2 ^= static_cast<uint64_t>(tail[9]) << 8;
+                case 9:  k2 ^= static_cast<uint64_t>(tail[8]);
+                         k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+
+                case 8:  k1 ^= static_cast<uint64_t>(tail[7]) << 56;
+                case 7:  k1 ^= static_cast<uint64_t>(tail[6]) << 48;
+                case 6:  k1 ^= static_cast<uint64_t>(tail[5]) << 40;
+                case 5:  k1 ^= static_cast<uint64_t>(tail[4]) << 32;
+                case 4:  k1 ^= static_cast<uint64_t>(tail[3]) << 24;
+                case 3:  k1 ^= static_cast<uint64_t>(tail[2]) << 16;
+                case 2:  k1 ^= static_cast<uint64_t>(tail[1]) << 8;
+                case 1:  k1 ^= static_cast<uint64_t>(tail[0]);
+                         k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+            }
+
+            h1 ^= length; h2 ^= length;
+            h1 += h2; h2 += h1;
+            h1 = fmix64(h1); h2 = fmix64(h2);
+            h1 += h2; h2 += h1;
+        }
+    }
+
+    // Replaces the key with its 128-bit digest, keeping the first few characters
+    // (with the illegal ones masked) so that it's still recognizable
+    inline void digest_key(const char* key, size_t length, std::string& result) {
+        static const size_t prefix_length = 64;
+        static const char hex[] = "0123456789abcdef";
+        uint64_t h1, h2;
+
+        detail::murmur3(key, length, h1, h2);
+
+        result.assign(key, std::min(length, prefix_length));
+
+        for(std::string::iterator it = result.begin(); it != result.end(); ++it) {
+            if(static_cast<unsigned char>(*it) <= ' ' || *it == 0x7f) {
+                *it = '_';
+            }
+        }
+
+        result += '#';
+
+        for(int shift = 60; shift >= 0; shift -= 4) {
+            result += hex[(h1 >> shift) & 0xf];
+        }
+
+        for(int shift = 60; shift >= 0; shift -= 4) {
+            result += hex[(h2 >> shift) & 0xf];
+        }
+    }
+}}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef YANDEX_MEMCACHED_POLICY_HPP
+#define YANDEX_MEMCACHED_POLICY_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+
+#include <boost/noncopyable.hpp>
+
+#include <stdint.h>
+
+namespace yandex { namespace memcached {
+    // Settings by namespace, as in 'policy:<prefix>:<setting>' options
+    typedef std::map<std::string, std::map<std::string, uint64_t> > policy_options_t;
+
+    // The settings which can differ between the namespaces
+    struct policy {
+        policy();
+
+        // Returns false for an unknown setting
+        bool set(const std::string& name, uint64_t value);
+
+        // The explicit expiration as it is, or a random one within the range
+        time_t expiration(time_t expire) const;
+
+        time_t expiration_minimum;
+        time_t expiration_maximum;
+        uint32_t compression_threshold;
+        uint32_t replication_factor;
+        bool write_behind;
+    };
+
+    // Policies by key prefix, the longest matching prefix wins, and the keys with
+    // no matching prefix get the defaults. Lookups don't allocate: the prefixes are
+    // kept sorted, and are searched for length by length, starting with the longest
+    class policy_table: private boost::noncopyable {
+        public:
+            policy_table();
+
+            // Not thread-safe, has to be called before the table is shared. Every prefix
+            // gets the defaults with its own settings applied on top of them
+            void reset(const policy& defaults, const policy_options_t& options);
+
+            const policy& resolve(const std::string& key) const;
+
+            inline const policy& defaults() const {
+                return m_defaults;
+            }
+
+            // The highest replication factor of all the policies
+            inline uint32_t replication() const {
+                return m_replication;
+            }
+
+        private:
+            typedef std::vector<std::pair<std::string, policy> > entries_t;
+
+            entries_t m_entries;
+            std::vector<size_t> m_lengths;
+            policy m_defaults;
+            uint32_t m_replication;
+    };
+}}
+
+#endif
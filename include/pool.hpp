@@ -0,0 +1,39 @@
+#ifndef YANDEX_MEMCACHED_POOL_HPP
+#define YANDEX_MEMCACHED_POOL_HPP
+
+#include <boost/noncopyable.hpp>
+
+#include <libmemcached/memcached.h>
+#include <libmemcached/util/pool.h>
+
+namespace yandex { namespace helpers {
+    // A connection borrowed from the pool for the duration of the scope. Unlike wrap<>,
+    // the way back is known at compile time, so there's no type-erased destructor
+    // to construct and call on every operation
+    struct pooled_connection: private boost::noncopyable {
+        public:
+            pooled_connection(memcached_pool_st* pool, bool blocking, memcached_return_t* rc):
+                m_pool(pool),
+                m_object(pool ? memcached_pool_pop(pool, blocking, rc) : NULL) {}
+
+            ~pooled_connection() {
+                if(m_object) {
+                    memcached_pool_push(m_pool, m_object);
+                }
+            }
+
+            inline memcached_st* operator*() const {
+                return m_object;
+            }
+
+            inline bool valid() const {
+                return (m_object != NULL);
+            }
+
+        private:
+            memcached_pool_st* m_pool;
+            memcached_st* m_object;
+    };
+}}
+
+#endif
@@ -2,6 +2,8 @@
 #include <boost/python/stl_iterator.hpp>
 #include <boost/assign.hpp>
 #include "cache.hpp"
+#include "hedging.hpp"
+#include "codec.hpp"
 
 #include <log4cxx/helpers/loglog.h>
 #include <log4cxx/xml/domconfigurator.h>
@@ -85,11 +87,14 @@ namespace yandex { namespace memcached { namespace python {
 
     class ClientWrapper {
         public:
-            typedef boost::function<bool (Client*, const std::string&, const std::string&, time_t)> store_fn_t;
-            typedef boost::function<void (Client*, cache_map_t&, time_t)> bulk_store_fn_t;
+            typedef boost::function<bool (Client*, const std::string&, const std::string&, time_t, uint32_t, uint32_t)> store_fn_t;
+            typedef boost::function<void (Client*, cache_map_t&, time_t, uint32_t, uint32_t)> bulk_store_fn_t;
+            typedef boost::function<bool (Client*, const std::string&, const std::string&)> concat_fn_t;
+            typedef boost::function<void (Client*, cache_map_t&)> bulk_concat_fn_t;
 
             ClientWrapper(const list& servers):
-                m_client(NULL)
+                m_client(NULL),
+                m_serialization(true)
             {
                 stl_input_iterator<std::string> begin(servers), end;
                 m_client = new Client(std::vector<std::string>(begin, end));
@@ -111,34 +116,101 @@ namespace yandex { namespace memcached { namespace python {
             double locality() {
                 return m_client->locality();
             }
+
+            // Values which are not plain strings are serialized with the codec,
+            // otherwise only strings can be stored
+            inline bool serialization() const {
+                return m_serialization;
+            }
+
+            inline void set_serialization(bool enabled) {
+                m_serialization = enabled;
+            }
             
-            str get(const str& key) const;
-            dict get_multi(const list& keys) const;
+            // Timeouts are in milliseconds, see Client
+            object get(const str& key, uint32_t timeout = 0) const;
+            dict get_multi(const list& keys, uint32_t timeout = 0) const;
 
-            inline bool set(const str& key, const str& value, time_t expire = 0) {
-                return store(&Client::set, key, value, expire);
+            // Returns the values which have arrived in time and the list of the late keys
+            tuple get_multi_partial(const list& keys, uint32_t timeout) const;
+
+            inline bool set(const str& key, const object& value, time_t expire = 0, uint32_t timeout = 0) {
+                return store(&Client::set, key, value, expire, timeout);
             }
 
-            inline dict set_multi(const dict& items, time_t expire = 0) {
-                return store(&Client::set_multi, items, expire);
+            inline dict set_multi(const dict& items, time_t expire = 0, uint32_t timeout = 0) {
+                return store(&Client::set_multi, items, expire, timeout);
             }
             
-            inline bool add(const str& key, const str& value, time_t expire = 0) {
-                return store(&Client::add, key, value, expire);
+            // Queued for the background writer when write-behind is enabled, see Client
+            inline bool set_async(const str& key, const object& value, time_t expire = 0) {
+                return store(&ClientWrapper::queue, key, value, expire, 0);
+            }
+
+            inline dict set_multi_async(const dict& items, time_t expire = 0) {
+                return store(&ClientWrapper::queue_multi, items, expire, 0);
             }
 
-            inline dict add_multi(const dict& items, time_t expire = 0) {
-                return store(&Client::add_multi, items, expire);
+            inline void flush_writes() {
+                scoped_gil_unlocker scoped;
+                m_client->flush_writes();
+            }
+
+            dict get_write_stats() const;
+            dict get_batch_stats() const;
+            dict get_health() const;
+            dict get_health_stats() const;
+
+            inline bool add(const str& key, const object& value, time_t expire = 0, uint32_t timeout = 0) {
+                return store(&Client::add, key, value, expire, timeout);
+            }
+
+            inline dict add_multi(const dict& items, time_t expire = 0, uint32_t timeout = 0) {
+                return store(&Client::add_multi, items, expire, timeout);
             }
             
-            inline bool replace(const str& key, const str& value, time_t expire = 0) {
-                return store(&Client::replace, key, value, expire);
+            inline bool replace(const str& key, const object& value, time_t expire = 0, uint32_t timeout = 0) {
+                return store(&Client::replace, key, value, expire, timeout);
+            }
+
+            inline dict replace_multi(const dict& items, time_t expire = 0, uint32_t timeout = 0) {
+                return store(&Client::replace_multi, items, expire, timeout);
+            }
+
+            inline bool append(const str& key, const str& value) {
+                return concat(&Client::append, key, value);
+            }
+
+            inline dict append_multi(const dict& items) {
+                return concat(&Client::append_multi, items);
+            }
+
+            inline bool prepend(const str& key, const str& value) {
+                return concat(&Client::prepend, key, value);
+            }
+
+            inline dict prepend_multi(const dict& items) {
+                return concat(&Client::prepend_multi, items);
+            }
+
+            tuple gets(const str& key) const;
+            dict gets_multi(const list& keys) const;
+
+            bool cas(const str& key, const object& value, uint64_t cas, time_t expire = 0);
+            dict cas_multi(const dict& items, time_t expire = 0);
+
+            inline object incr(const str& key, uint64_t delta = 1, const object& initial = object(), time_t expire = 0) {
+                return arithmetic(true, key, delta, initial, expire);
             }
 
-            inline dict replace_multi(const dict& items, time_t expire = 0) {
-                return store(&Client::replace_multi, items, expire);
+            inline object decr(const str& key, uint64_t delta = 1, const object& initial = object(), time_t expire = 0) {
+                return arithmetic(false, key, delta, initial, expire);
             }
             
+            bool touch(const str& key, time_t expire = 0);
+            list touch_multi(const list& keys, time_t expire = 0);
+            object get_and_touch(const str& key, time_t expire = 0);
+
             bool remove(const str& key);
             list remove_multi(const list& keys);
             
@@ -147,11 +219,77 @@ namespace yandex { namespace memcached { namespace python {
             }
 
             list get_stats() const;
+            dict get_errors() const;
+            object get_cluster_stats() const;
+
+            inline bool start_trace(const std::string& path, uint32_t capacity = 65536) {
+                return m_client->start_trace(path, capacity);
+            }
+
+            inline bool save_hot_keys(const std::string& path) const {
+                scoped_gil_unlocker scoped;
+                return m_client->save_hot_keys(path);
+            }
+
+            inline void snapshot_hot_keys(const std::string& path, uint32_t interval = 0) {
+                scoped_gil_unlocker scoped;
+                m_client->snapshot_hot_keys(path, interval);
+            }
+
+            dict warm(const std::string& path, uint32_t chunk = 256) const;
+
+            inline void stop_trace() {
+                scoped_gil_unlocker scoped;
+                m_client->stop_trace();
+            }
+
+            str namespaced_key(const str& ns, const str& key);
+            list namespaced_keys(const list& keys);
+            bool invalidate_namespace(const str& ns);
 
         private:
-            bool store(store_fn_t store_fn, const str& key, const str& value, time_t expire);
-            dict store(bulk_store_fn_t store_fn, const dict& items, time_t expire);
+            bool store(store_fn_t store_fn, const str& key, const object& value, time_t expire, uint32_t timeout);
+            dict store(bulk_store_fn_t store_fn, const dict& items, time_t expire, uint32_t timeout);
+            bool concat(concat_fn_t concat_fn, const str& key, const str& value);
+            dict concat(bulk_concat_fn_t concat_fn, const dict& items);
+
+            // The queued writes don't wait for the servers, so there's no timeout to pass on
+            static inline bool queue(Client* client, const std::string& key, const std::string& value,
+                time_t expire, uint32_t codec, uint32_t)
+            {
+                return client->set_async(key, value, expire, codec);
+            }
+
+            static inline void queue_multi(Client* client, cache_map_t& items, time_t expire, uint32_t codec, uint32_t) {
+                client->set_multi_async(items, expire, codec);
+            }
+
+            object arithmetic(bool increment, const str& key, uint64_t delta, const object& initial, time_t expire);
+
+            uint32_t encode(const object& value, std::string& result) const;
 
             Client* m_client;
+            Codec m_codec;
+            bool m_serialization;
+
+            friend class HedgerWrapper;
+    };
+
+    // Hedged reads across two clients, see hedged_reader. The values are decoded
+    // the way the primary client decodes them
+    class HedgerWrapper: private boost::noncopyable {
+        public:
+            HedgerWrapper(const ClientWrapper& primary, const ClientWrapper& backup, uint32_t percentile,
+                uint32_t initial_delay, uint32_t minimum_delay, uint32_t limit, uint32_t concurrency):
+                m_primary(primary),
+                m_reader(*primary.m_client, *backup.m_client, percentile, initial_delay, minimum_delay,
+                    limit, concurrency) {}
+
+            dict get_multi(const list& keys);
+            dict get_stats() const;
+
+        private:
+            const ClientWrapper& m_primary;
+            hedged_reader m_reader;
     };
 }}} // namespace Yandex::Memcached::Python
@@ -59,5 +59,9 @@ namespace yandex { namespace helpers { namespace smartrouting {
     theInterfaces;
 
     bool is_same_subnet(const std::string& hostname);
+
+    // Network address of the host, masked with the netmask of the local interface
+    // on the same subnet if there's one, and as a /24 otherwise
+    unsigned long subnet(const std::string& hostname);
 }}}
 #endif
@@ -0,0 +1,119 @@
+#ifndef YANDEX_MEMCACHED_STATS_HPP
+#define YANDEX_MEMCACHED_STATS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <libmemcached/memcached.h>
+
+#include <stdint.h>
+
+namespace yandex { namespace memcached {
+    // A slab class, from "stats slabs" and "stats items"
+    struct slab_stats {
+        slab_stats():
+            chunk_size(0),
+            chunks_per_page(0),
+            total_pages(0),
+            total_chunks(0),
+            used_chunks(0),
+            free_chunks(0),
+            requested(0),
+            items(0),
+            age(0),
+            evicted(0),
+            outofmemory(0),
+            wasted(0),
+            waste(0.0),
+            evictions_per_second(0.0) {}
+
+        uint64_t chunk_size, chunks_per_page, total_pages, total_chunks, used_chunks, free_chunks;
+        uint64_t requested, items, age, evicted, outofmemory;
+
+        // The bytes allocated to the chunks in use which the items don't need,
+        // and their share of the allocation
+        uint64_t wasted;
+        double waste;
+
+        double evictions_per_second;
+    };
+
+    typedef std::map<uint32_t, slab_stats> slabs_t;
+
+    // A server, from "stats", with the rates over the last sampling interval
+    struct server_stats {
+        server_stats():
+            alive(false),
+            uptime(0),
+            items(0),
+            bytes(0),
+            limit(0),
+            connections(0),
+            gets(0),
+            sets(0),
+            hits(0),
+            misses(0),
+            evictions(0),
+            bytes_read(0),
+            bytes_written(0),
+            hit_ratio(0.0),
+            gets_per_second(0.0),
+            sets_per_second(0.0),
+            evictions_per_second(0.0),
+            bytes_read_per_second(0.0),
+            bytes_written_per_second(0.0),
+            share(0.0) {}
+
+        std::string name;
+        bool alive;
+
+        uint64_t uptime, items, bytes, limit, connections;
+        uint64_t gets, sets, hits, misses, evictions, bytes_read, bytes_written;
+
+        // Over the interval when there's a previous sample, over the uptime otherwise
+        double hit_ratio;
+
+        double gets_per_second, sets_per_second, evictions_per_second;
+        double bytes_read_per_second, bytes_written_per_second;
+
+        // The server's part of the cluster's requests
+        double share;
+
+        slabs_t slabs;
+    };
+
+    struct cluster_stats {
+        cluster_stats():
+            sampled(0) {}
+
+        time_t sampled;
+        std::vector<server_stats> servers;
+    };
+
+    typedef boost::shared_ptr<const cluster_stats> cluster_stats_ptr;
+
+    // Samples the servers and keeps the latest snapshot, which is immutable, so
+    // the readers only ever copy a pointer to it
+    class stats_collector: private boost::noncopyable {
+        public:
+            stats_collector();
+
+            void sample(memcached_st* connection);
+
+            // Empty until the first sample has been taken
+            cluster_stats_ptr snapshot() const;
+
+        private:
+            cluster_stats_ptr m_snapshot;
+            uint64_t m_sampled;
+            mutable boost::mutex m_mutex;
+    };
+}}
+
+#endif
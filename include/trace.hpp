@@ -0,0 +1,170 @@
+#ifndef YANDEX_MEMCACHED_TRACE_HPP
+#define YANDEX_MEMCACHED_TRACE_HPP
+
+#include <string>
+#include <cstdio>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <libmemcached/memcached.h>
+
+#include <stdint.h>
+
+namespace yandex { namespace memcached {
+    enum trace_op {
+        trace_get = 1,
+        trace_get_multi,
+        trace_set,
+        trace_add,
+        trace_replace,
+        trace_append,
+        trace_prepend,
+        trace_cas,
+        trace_incr,
+        trace_decr,
+        trace_touch,
+        trace_remove
+    };
+
+    namespace trace_flags {
+        const uint8_t compressed = 0x01;
+        const uint8_t chunked = 0x02;
+    }
+
+    // The trace file is a header followed by the records, in the byte order of the host.
+    // Only the hashes of the keys are recorded, and the records of the multi-key calls
+    // share the call and the timestamp, which is the start of the call in microseconds.
+    // The value length is the one on the wire, and the inflated one is the length before
+    // the compression, which is the same for the values which aren't compressed
+    struct trace_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+    };
+
+    struct trace_record {
+        uint64_t timestamp;
+        uint64_t key_hash;
+        uint32_t call;
+        uint32_t value_length;
+        uint32_t latency;
+        uint16_t key_length;
+        uint16_t result;
+        uint8_t op;
+        uint8_t flags;
+        uint8_t reserved[2];
+        uint32_t inflated_length;
+    };
+
+    const char trace_magic[8] = { 'Y', 'M', 'C', 'T', 'R', 'A', 'C', 'E' };
+    const uint32_t trace_version = 2;
+
+    // The zero call is the one made with the tracing off
+    struct trace_call {
+        trace_call():
+            id(0),
+            start(0) {}
+
+        uint32_t id;
+        uint64_t start;
+    };
+
+    // Opt-in operation tracer: the callers push the records into a lock-free ring, and
+    // a background thread writes them out. Records which don't fit into the ring are
+    // dropped and counted rather than slowing the callers down
+    class tracer: private boost::noncopyable {
+        public:
+            tracer();
+            ~tracer();
+
+            // Not thread-safe with each other. The ring is allocated on the first start
+            // and kept until the tracer is destroyed, so its capacity can't change later
+            bool start(const std::string& path, uint32_t capacity);
+            void stop();
+
+            inline bool enabled() const {
+                return m_enabled;
+            }
+
+            // Starts a call when the tracing is on
+            trace_call begin();
+
+            void record(const trace_call& call, trace_op op, const std::string& key, size_t value_length,
+                size_t inflated_length, uint8_t flags, memcached_return_t rc);
+
+            inline uint64_t dropped() const {
+                return m_dropped;
+            }
+
+            // Microseconds since the epoch
+            static uint64_t now();
+
+        private:
+            struct cell {
+                volatile uint64_t sequence;
+                trace_record record;
+            };
+
+            bool pop(trace_record& record);
+            void drain();
+
+            boost::scoped_array<cell> m_cells;
+            uint64_t m_mask;
+            volatile uint64_t m_tail;
+            uint64_t m_head;
+
+            volatile bool m_enabled;
+            volatile uint32_t m_calls;
+            volatile uint64_t m_dropped;
+
+            FILE* m_file;
+            boost::scoped_ptr<boost::thread> m_writer;
+    };
+
+    // Records an operation on a single key when it goes out of scope, costing a branch
+    // when the tracing is off
+    struct trace_scope: private boost::noncopyable {
+        public:
+            trace_scope(tracer& t, trace_op op, const std::string& key):
+                value_length(0),
+                inflated_length(0),
+                flags(0),
+                rc(MEMCACHED_SUCCESS),
+                m_tracer(t.enabled() ? &t : NULL),
+                m_op(op),
+                m_key(key),
+                m_call(t.begin()) {}
+
+            // Part of a multi-key call
+            trace_scope(tracer& t, trace_op op, const std::string& key, const trace_call& call):
+                value_length(0),
+                inflated_length(0),
+                flags(0),
+                rc(MEMCACHED_SUCCESS),
+                m_tracer(t.enabled() ? &t : NULL),
+                m_op(op),
+                m_key(key),
+                m_call(call) {}
+
+            ~trace_scope() {
+                if(m_tracer) {
+                    m_tracer->record(m_call, m_op, m_key, value_length, inflated_length, flags, rc);
+                }
+            }
+
+            size_t value_length, inflated_length;
+            uint8_t flags;
+            memcached_return_t rc;
+
+        private:
+            tracer* m_tracer;
+            trace_op m_op;
+            const std::string& m_key;
+            trace_call m_call;
+    };
+}}
+
+#endif
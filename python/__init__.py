@@ -1,37 +1,23 @@
 # coding: utf-8
 
-from _memcached import Client as ClientBase
+from _memcached import Client as ClientBase, Hedger
 
-try:
-    import cPickle as pickle
-except ImportError:
-    import pickle
-    
 
-class Client(ClientBase):
-    # Helper methods
-    def _pickled(self, arg):
-        if not self.autopickling:
-            return arg
+def _milliseconds(timeout):
+    # Timeouts are given in seconds, like everywhere else in Python
+    if timeout is None:
+        return 0
 
-        if isinstance(arg, str):
-            return arg
-        else:
-            return pickle.dumps(arg)
+    return max(1, int(timeout * 1000))
 
-    def _unpickled(self, arg):
-        if not self.autopickling:
-            return arg
 
-        try:
-            return pickle.loads(arg)
-        except:
-            return arg
-    
+class Client(ClientBase):
+    # Values are serialized by the extension module, which uses a native codec
+    # for builtin types and falls back to pickle for the rest
+    autopickling = property(ClientBase.serialization, ClientBase.set_serialization)
+
     # Basic initialization
     def __init__(self, servers):
-        self.autopickling = True
-
         if isinstance(servers, basestring):
             servers = [servers]
 
@@ -46,45 +32,122 @@ class Client(ClientBase):
         super(Client, self).configure(config)
 
     # pylibmc-like interface
-    def get(self, key, default = None):
-        value = super(Client, self).get(str(key))
+    def get(self, key, default = None, timeout = None):
+        value = super(Client, self).get(str(key), _milliseconds(timeout))
         
-        if not value:
+        if value is None:
             return default
         
-        return self._unpickled(value)
+        return value
+
+    def set(self, key, value, expire = 0, timeout = None):
+        return super(Client, self).set(str(key), value, long(expire), _milliseconds(timeout))
 
-    def set(self, key, value, expire = 0):
-        return super(Client, self).set(str(key), self._pickled(value), long(expire))
+    # Fire-and-forget writes, see the write-behind options
+    def set_async(self, key, value, expire = 0):
+        return super(Client, self).set_async(str(key), value, long(expire))
 
-    def add(self, key, value, expire = 0):
-        return super(Client, self).add(str(key), self._pickled(value), long(expire))
+    def set_multi_async(self, items, expire = 0):
+        items = dict((str(k), v) for k, v in items.iteritems())
+        return super(Client, self).set_multi_async(items, long(expire))
 
-    def replace(self, key, value, expire = 0):
-        return super(Client, self).replace(str(key), self._pickled(value), long(expire))
+    def add(self, key, value, expire = 0, timeout = None):
+        return super(Client, self).add(str(key), value, long(expire), _milliseconds(timeout))
+
+    def replace(self, key, value, expire = 0, timeout = None):
+        return super(Client, self).replace(str(key), value, long(expire), _milliseconds(timeout))
 
     def delete(self, key):
         return super(Client, self).delete(str(key))
     
-    def get_multi(self, keys):
-        items = super(Client, self).get_multi([str(key) for key in keys])
-        return dict((k, self._unpickled(v)) for k, v in items.iteritems())
+    def get_multi(self, keys, timeout = None):
+        return super(Client, self).get_multi([str(key) for key in keys], _milliseconds(timeout))
+
+    # Returns the values which have arrived in time along with the list of the keys
+    # which haven't, which might be either misses or just late
+    def get_multi_partial(self, keys, timeout):
+        return super(Client, self).get_multi_partial([str(key) for key in keys], _milliseconds(timeout))
 
-    def set_multi(self, items, expire = 0):
-        items = dict((str(k), self._pickled(v)) for k, v in items.iteritems())
-        return super(Client, self).set_multi(items, long(expire))
+    def set_multi(self, items, expire = 0, timeout = None):
+        items = dict((str(k), v) for k, v in items.iteritems())
+        return super(Client, self).set_multi(items, long(expire), _milliseconds(timeout))
     
-    def add_multi(self, items, expire = 0):
-        items = dict((str(k), self._pickled(v)) for k, v in items.iteritems())
-        return super(Client, self).add_multi(items, long(expire))
+    def add_multi(self, items, expire = 0, timeout = None):
+        items = dict((str(k), v) for k, v in items.iteritems())
+        return super(Client, self).add_multi(items, long(expire), _milliseconds(timeout))
 
-    def replace_multi(self, items, expire = 0):
-        items = dict((str(k), self._pickled(v)) for k, v in items.iteritems())
-        return super(Client, self).replace_multi(items, long(expire))
+    def replace_multi(self, items, expire = 0, timeout = None):
+        items = dict((str(k), v) for k, v in items.iteritems())
+        return super(Client, self).replace_multi(items, long(expire), _milliseconds(timeout))
 
     def delete_multi(self, keys):
         return super(Client, self).delete_multi([str(key) for key in keys])
 
+    # Concatenation works on raw strings, as serialized values can't be glued together
+    def append(self, key, value):
+        return super(Client, self).append(str(key), str(value))
+
+    def append_multi(self, items):
+        items = dict((str(k), str(v)) for k, v in items.iteritems())
+        return super(Client, self).append_multi(items)
+
+    def prepend(self, key, value):
+        return super(Client, self).prepend(str(key), str(value))
+
+    def prepend_multi(self, items):
+        items = dict((str(k), str(v)) for k, v in items.iteritems())
+        return super(Client, self).prepend_multi(items)
+
+    # Expiration
+    def touch(self, key, expire = 0):
+        return super(Client, self).touch(str(key), long(expire))
+
+    def touch_multi(self, keys, expire = 0):
+        return super(Client, self).touch_multi([str(key) for key in keys], long(expire))
+
+    def get_and_touch(self, key, expire = 0, default = None):
+        value = super(Client, self).get_and_touch(str(key), long(expire))
+
+        if value is None:
+            return default
+
+        return value
+
+    # CAS and counters
+    def gets(self, key, default = None):
+        value, cas = super(Client, self).gets(str(key))
+
+        if value is None:
+            return default, cas
+
+        return value, cas
+
+    def gets_multi(self, keys):
+        return super(Client, self).gets_multi([str(key) for key in keys])
+
+    def cas(self, key, value, cas, expire = 0):
+        return super(Client, self).cas(str(key), value, long(cas), long(expire))
+
+    def cas_multi(self, items, expire = 0):
+        items = dict((str(k), (v, long(cas))) for k, (v, cas) in items.iteritems())
+        return super(Client, self).cas_multi(items, long(expire))
+
+    def incr(self, key, delta = 1, initial = None, expire = 0):
+        return super(Client, self).incr(str(key), long(delta), initial, long(expire))
+
+    def decr(self, key, delta = 1, initial = None, expire = 0):
+        return super(Client, self).decr(str(key), long(delta), initial, long(expire))
+
+    # Namespaces
+    def namespaced_key(self, ns, key):
+        return super(Client, self).namespaced_key(str(ns), str(key))
+
+    def namespaced_keys(self, keys):
+        return super(Client, self).namespaced_keys([(str(ns), str(key)) for ns, key in keys])
+
+    def invalidate_namespace(self, ns):
+        return super(Client, self).invalidate_namespace(str(ns))
+
     # dict-like interface
     def __getitem__(self, key):
         value = self.get(key)
@@ -132,7 +195,7 @@ class Client(ClientBase):
 
 
 class ClientPool(object):
-    def __init__(self, groups):
+    def __init__(self, groups, hedging = None):
         self.groups = {}
         
         for group, servers in groups.iteritems():
@@ -142,9 +205,57 @@ class ClientPool(object):
         name, self.closest = max(self.groups.iteritems(),
             key = lambda item: item[1].locality())
 
+        # Groups by locality, the closest one first
+        self.order = sorted(self.groups, key = lambda group: -self.groups[group].locality())
+        self.hedging = False
+
+        if hedging:
+            self.configure_hedging(**hedging)
+
     def configure(self, config):
         [group.configure(config) for group in self.groups.itervalues()]
-        
+
+    # Hedged reads: when the closest group hasn't answered within the given percentile
+    # of its recent latencies, or has failed, the keys are requested from the next group
+    # as well, with the first request still in flight, and the first complete answer wins.
+    # The race runs in the extension module without the GIL. The number of the hedges
+    # in flight is capped, the reads over the limit just wait for the closest group, and
+    # the reads over the concurrency limit aren't hedged at all. Delays are in seconds
+    def configure_hedging(self, percentile = 95, initial_delay = 0.01, minimum_delay = 0.001, limit = 8,
+        concurrency = 64):
+        self.hedging = len(self.groups) > 1
+
+        if self.hedging:
+            self.hedger = Hedger(self.groups[self.order[0]], self.groups[self.order[1]], percentile,
+                int(initial_delay * 1000000), int(minimum_delay * 1000000), limit, concurrency)
+
+    def hedge_stats(self):
+        if not self.hedging:
+            return {}
+
+        stats = self.hedger.get_stats()
+        stats['rate'] = float(stats['hedged']) / stats['reads'] if stats['reads'] else 0.0
+        stats['delay'] = stats['delay'] / 1000000.0
+
+        return stats
+
+    def get(self, key, default = None):
+        if not self.hedging:
+            return self.closest.get(key, default)
+
+        value = self.hedger.get_multi([str(key)]).get(str(key))
+
+        if value is None:
+            return default
+
+        return value
+
+    def get_multi(self, keys):
+        if not self.hedging:
+            return self.closest.get_multi(keys)
+
+        return self.hedger.get_multi([str(key) for key in keys])
+
     def __getattr__(self, name):
         return getattr(self.closest, name)
 
@@ -1,34 +1,97 @@
 # coding: utf-8
 
+import os
+import threading
+
 from django.core.cache.backends.memcached import BaseMemcachedCache
 import lymc
 
+try:
+    from django.core.cache.backends.base import DEFAULT_TIMEOUT
+except ImportError:
+    DEFAULT_TIMEOUT = None
+
+# Native clients are shared by all the cache instances of a process with the
+# same configuration, so that there's only one connection pool per cluster
+_clients = {}
+_clients_lock = threading.Lock()
+
+def _shared_client(servers, options):
+    key = (os.getpid(), tuple(servers), tuple(sorted(options.iteritems())))
+
+    with _clients_lock:
+        try:
+            return _clients[key]
+        except KeyError:
+            pass
+
+        client = lymc.Client(list(servers))
+
+        if options:
+            # Client.configure() consumes the options it handles itself
+            client.configure(dict(options))
+
+        _clients[key] = client
+
+        return client
+
+
 class YandexMemcachedCache(BaseMemcachedCache):
     def __init__(self, server, params):
         super(YandexMemcachedCache, self).__init__(server, params,
                                                    library=lymc,
-                                                   value_not_found_exception=NotImplementedError)
+                                                   value_not_found_exception=ValueError)
+
+        self._client = None
+        self._client_pid = None
 
     @property
     def _cache(self):
-        if self.client:
-            return client
+        # Re-fetching after a fork, as connections can't be shared across processes
+        if self._client is None or self._client_pid != os.getpid():
+            self._client = _shared_client(self._servers, self._options or {})
+            self._client_pid = os.getpid()
 
-        client = self._lib.Client(self._servers)
+        return self._client
 
-        if self._options:
-            client.configure(self._options)
+    def _timeout(self, timeout):
+        if hasattr(self, 'get_backend_timeout'):
+            return self.get_backend_timeout(timeout)
 
-        self.client = client
+        return self._get_memcache_timeout(timeout)
 
-        return client
+    def get_many(self, keys, version=None):
+        keys = dict((self.make_key(key, version=version), key) for key in keys)
+        items = self._cache.get_multi(keys.keys())
+
+        return dict((keys[k], v) for k, v in items.iteritems())
+
+    def set_many(self, data, timeout=DEFAULT_TIMEOUT, version=None):
+        keys = dict((self.make_key(key, version=version), key) for key in data)
+        items = dict((k, data[key]) for k, key in keys.iteritems())
+        failed = self._cache.set_multi(items, self._timeout(timeout))
+
+        return [keys[k] for k in failed]
+
+    def delete_many(self, keys, version=None):
+        self._cache.delete_multi([self.make_key(key, version=version) for key in keys])
 
     def incr(self, key, delta=1, version=None):
-        raise NotImplementedError
+        key = self.make_key(key, version=version)
+
+        if delta < 0:
+            value = self._cache.decr(key, -delta)
+        else:
+            value = self._cache.incr(key, delta)
+
+        if value is None:
+            raise ValueError("Key '%s' not found" % key)
+
+        return value
 
     def decr(self, key, delta=1, version=None):
-        raise NotImplementedError
+        return self.incr(key, -delta, version=version)
 
     def close(self, **kwargs):
-        # No need to disconnect, connections are not persistent
+        # No need to disconnect, connections are pooled by the shared client
         pass
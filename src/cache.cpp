@@ -1,22 +1,32 @@
 #include "cache.hpp"
 #include "wrap.hpp"
+#include "pool.hpp"
 #include "compression.hpp"
+#include "chunking.hpp"
 #include "smartrouting.hpp"
 
-#include "boost/lambda/bind.hpp"
+#include <set>
+#include <time.h>
+
+#include "boost/lexical_cast.hpp"
+#include "boost/bind.hpp"
 #include "boost/algorithm/string/split.hpp"
 #include "boost/algorithm/string/classification.hpp"
+#include "boost/ref.hpp"
+#include "boost/make_shared.hpp"
 
 namespace yandex { namespace memcached {
     using namespace std;
     using namespace log4cxx;
     using namespace yandex::helpers;
-    using namespace boost::lambda;
 
     Client::Client(const vector<string>& servers):
         m_pool(NULL),
         m_log(Logger::getLogger("ru.yandex.memcached")),
-        m_config()
+        m_config(),
+        m_routes(boost::make_shared<cache_vector_t>()),
+        m_policies(boost::make_shared<policy_table>()),
+        m_stopping(false)
     {
         LOG4CXX_INFO(m_log, "initializing");
         
@@ -56,10 +66,12 @@ namespace yandex { namespace memcached {
 
             LOG4CXX_INFO(m_log, boost::format("configuring server %1%") % host[0]);
             
-            server_list = memcached_server_list_append(
+            // Weights, as in 'host:port:weight', only matter with weighted consistent hashing
+            server_list = memcached_server_list_append_with_weight(
                 server_list.release(),
                 host[0].c_str(),
-                host.size() == 2 ? atoi(host[1].c_str()) : 11211,
+                host.size() >= 2 ? atoi(host[1].c_str()) : 11211,
+                host.size() >= 3 ? atoi(host[2].c_str()) : 1,
                 &rc);
             
             LOG4CXX_ASSERT(m_log, rc == MEMCACHED_SUCCESS, 
@@ -82,11 +94,38 @@ namespace yandex { namespace memcached {
         // Store the locality factor
         m_config.locality = locals * 100.0 / memcached_server_count(*memcached);
         
+        // Error counters are kept per server
+        m_errors.reset(*memcached);
+        m_health.reset(*memcached);
+
+        // Subnets are used to spread the replicas
+        for(uint32_t i = 0; i < memcached_server_count(*memcached); ++i) {
+            memcached_server_instance_st instance = memcached_server_instance_by_position(*memcached, i);
+
+            try {
+                m_subnets.push_back(smartrouting::subnet(memcached_server_name(instance)));
+            } catch(const std::runtime_error&) {
+                // Assuming that the server is on a subnet of its own
+                m_subnets.push_back(numeric_limits<unsigned long>::max() - i);
+            }
+        }
+
+        route(*memcached);
+
         // Creating the default pool
         m_pool = memcached_pool_create(memcached.release(), m_config.pool.size / 2, m_config.pool.size);
     }
 
     Client::~Client() {
+        // The pending writes are flushed while the pool is still there
+        stop_writer();
+        stop_sampler();
+        stop_snapshots();
+        stop_prober();
+
+        // The failures since the last report would never be logged otherwise
+        report_pending(true);
+
         if(m_pool) {
             memcached_st* memcached = memcached_pool_destroy(m_pool);
             memcached_free(memcached);
@@ -109,13 +148,16 @@ namespace yandex { namespace memcached {
             ("cache-lookups", MEMCACHED_BEHAVIOR_CACHE_LOOKUPS)
             ("binary-protocol", MEMCACHED_BEHAVIOR_BINARY_PROTOCOL)
             ("consistent-hashing", MEMCACHED_BEHAVIOR_KETAMA)
+            ("weighted-hashing", MEMCACHED_BEHAVIOR_KETAMA_WEIGHTED)
             ("tcp-nodelay", MEMCACHED_BEHAVIOR_TCP_NODELAY)
             ("tcp-keepalive", MEMCACHED_BEHAVIOR_TCP_KEEPALIVE)
             ("tcp-keepalive-timeout", MEMCACHED_BEHAVIOR_TCP_KEEPIDLE)
             ("server-failure-limit", MEMCACHED_BEHAVIOR_SERVER_FAILURE_LIMIT)
             ("server-poll-timeout", MEMCACHED_BEHAVIOR_POLL_TIMEOUT)
             ("server-connect-timeout", MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT)
-            ("server-retry-timeout", MEMCACHED_BEHAVIOR_RETRY_TIMEOUT);
+            ("server-retry-timeout", MEMCACHED_BEHAVIOR_RETRY_TIMEOUT)
+            ("support-cas", MEMCACHED_BEHAVIOR_SUPPORT_CAS);
+        const string policy_prefix("policy:");
 
         for(map<string, uint64_t>::const_iterator it = config.begin(); it != config.end(); ++it) {
             LOG4CXX_INFO(m_log, boost::format("setting %1% to %2%") % it->first % it->second);
@@ -133,6 +175,49 @@ namespace yandex { namespace memcached {
                 m_config.pool.blocking = it->second;
             } else if(it->first == "compression-threshold") {
                 m_config.compression.threshold = it->second;
+            } else if(it->first == "chunk-size") {
+                m_config.chunking.size = it->second;
+            } else if(it->first == "namespace-ttl") {
+                m_config.namespaces.ttl = it->second;
+            } else if(it->first == "hash-keys") {
+                m_config.keys.hashing = it->second;
+            } else if(it->first == "replication-factor") {
+                m_config.replication.factor = std::max<uint64_t>(it->second, 1);
+            } else if(it->first == "write-behind-limit") {
+                m_config.write_behind.limit = it->second;
+            } else if(it->first == "write-behind-batch") {
+                m_config.write_behind.batch = std::max<uint64_t>(it->second, 1);
+            } else if(it->first == "write-behind-delay") {
+                m_config.write_behind.delay = it->second;
+            } else if(it->first == "write-behind-wait") {
+                m_config.write_behind.wait = it->second;
+            } else if(it->first == "stats-interval") {
+                m_config.stats.interval = it->second;
+            } else if(it->first == "batch-window") {
+                m_config.batching.window = it->second;
+            } else if(it->first == "batch-size") {
+                m_config.batching.size = std::max<uint64_t>(it->second, 1);
+            } else if(it->first == "health-interval") {
+                m_config.health.interval = it->second;
+            } else if(it->first == "health-timeout") {
+                m_config.health.timeout = std::max<uint64_t>(it->second, 1);
+            } else if(it->first == "health-failures") {
+                m_config.health.failures = std::max<uint64_t>(it->second, 1);
+            } else if(it->first == "hot-keys") {
+                m_config.hot_keys.capacity = it->second;
+            } else if(it->first == "hot-keys-sample") {
+                m_config.hot_keys.sample = std::max<uint64_t>(it->second, 1);
+            } else if(it->first.compare(0, policy_prefix.length(), policy_prefix) == 0) {
+                // Namespace policies, as in 'policy:<prefix>:<setting>'
+                string::size_type separator = it->first.rfind(':');
+
+                if(separator < policy_prefix.length() || !policy().set(it->first.substr(separator + 1), it->second)) {
+                    LOG4CXX_WARN(m_log, boost::format("skipping invalid policy option %1%") % it->first);
+                    continue;
+                }
+
+                m_policy_options[it->first.substr(policy_prefix.length(), separator - policy_prefix.length())]
+                    [it->first.substr(separator + 1)] = it->second;
             } else if(it->first == "default-expiration-minimum") {
                 m_config.expiration.minimum = it->second;
             } else if(it->first == "default-expiration-maximum") {
@@ -141,283 +226,2549 @@ namespace yandex { namespace memcached {
                 LOG4CXX_WARN(m_log, boost::format("skipping unknown option %1%") % it->first);
             }
         }
+
+        if(m_config.write_behind.limit && !m_writer) {
+            start_writer();
+        } else if(!m_config.write_behind.limit && m_writer) {
+            stop_writer();
+        }
+
+        // Every namespace policy starts with the global settings
+        policy defaults;
+
+        defaults.expiration_minimum = m_config.expiration.minimum;
+        defaults.expiration_maximum = m_config.expiration.maximum;
+        defaults.compression_threshold = m_config.compression.threshold;
+        defaults.replication_factor = m_config.replication.factor;
+
+        // Built aside and swapped in, as the requests in flight keep looking policies up
+        boost::shared_ptr<policy_table> policies = boost::make_shared<policy_table>();
+
+        policies->reset(defaults, m_policy_options);
+
+        boost::atomic_store(&m_policies, boost::shared_ptr<const policy_table>(policies));
+
+        // The hashing might have changed, and with it the servers the routing keys go to
+        {
+            pooled_connection connection(m_pool, true, &rc);
+
+            if(connection.valid()) {
+                route(*connection);
+            }
+        }
+
+        if(config.count("hot-keys") || config.count("hot-keys-sample")) {
+            m_hot_keys.reset(m_config.hot_keys.capacity, m_config.hot_keys.sample);
+        }
+
+        if(m_config.health.interval && !m_prober) {
+            start_prober();
+        } else if(!m_config.health.interval && m_prober) {
+            stop_prober();
+        }
+
+        if(m_config.stats.interval && !m_sampler) {
+            start_sampler();
+        } else if(!m_config.stats.interval && m_sampler) {
+            stop_sampler();
+        }
     }
 
-    string Client::get(const string& key) {
-        memcached_return_t rc;
-        string result;
-        wrap<char*> value(NULL, free);
-        size_t value_length;
-        uint32_t inflated_length;
-        wrap<memcached_st> connection(
-            m_pool ? memcached_pool_pop(m_pool, m_config.pool.blocking, &rc) : NULL,
-            bind(memcached_pool_push, m_pool, _1));
-        decompressor<lzo> inflate;
+    struct Client::chunked_value {
+        chunked_value(const string& key_, uint32_t flags_, uint64_t cas_):
+            key(key_),
+            flags(flags_),
+            cas(cas_),
+            received(0) {}
 
-        if(!connection.valid()) {
-            return result;
+        string key;
+        uint32_t flags;
+        uint64_t cas;
+        helpers::manifest manifest;
+        string payload;
+        uint32_t received;
+    };
+
+    // Bounds the socket operations on a connection by the time left until the deadline,
+    // restoring the configured timeouts afterwards. A connection which has been cut off
+    // in the middle of a response is reset before it goes back to the pool
+    struct Client::deadline: private boost::noncopyable {
+        deadline(memcached_st* connection_, uint32_t timeout_):
+            connection(connection_),
+            timeout(timeout_),
+            expired(false),
+            start(timeout_ ? now() : 0),
+            poll(0),
+            connect(0)
+        {
+            if(timeout) {
+                poll = memcached_behavior_get(connection, MEMCACHED_BEHAVIOR_POLL_TIMEOUT);
+                connect = memcached_behavior_get(connection, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT);
+            }
         }
 
-        if(key.empty()) {
-            return result;
+        ~deadline() {
+            if(!timeout) {
+                return;
+            }
+
+            if(expired) {
+                memcached_quit(connection);
+            }
+
+            memcached_behavior_set(connection, MEMCACHED_BEHAVIOR_POLL_TIMEOUT, poll);
+            memcached_behavior_set(connection, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, connect);
         }
 
-        value = memcached_get(*connection, key.data(), key.length(),
-            &value_length, &inflated_length, &rc);
+        // Has to be called before every blocking operation, returns false
+        // when there's no time left for it
+        bool arm() {
+            if(!timeout) {
+                return true;
+            }
 
-        if(rc != MEMCACHED_SUCCESS) {
-            LOG4CXX_ASSERT(m_log, rc == MEMCACHED_NOTFOUND,
-                error(__func__, *connection, rc, key));
-            return result;
+            uint64_t elapsed = now() - start;
+
+            if(expired || elapsed >= timeout) {
+                expired = true;
+                return false;
+            }
+
+            memcached_behavior_set(connection, MEMCACHED_BEHAVIOR_POLL_TIMEOUT, timeout - elapsed);
+            memcached_behavior_set(connection, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, timeout - elapsed);
+
+            return true;
         }
 
-        if(inflated_length) {
-            if(inflate(*value, value_length, inflated_length)) {
-                result.assign(inflate.data(), inflate.length());
-            } else {
-                LOG4CXX_ERROR(m_log, boost::format("failed to decompress the value for key %1%") % key);
+        inline void check(memcached_return_t rc) {
+            if(timeout && rc == MEMCACHED_TIMEOUT) {
+                expired = true;
             }
-        } else {
-            result.assign(*value, value_length);
         }
 
-        return result;
-    }
+        static uint64_t now() {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    cache_map_t Client::get_multi(const cache_vector_t& keys) {
-        memcached_return_t rc;
-        cache_map_t result;
-        wrap<memcached_st> connection(
-            m_pool ? memcached_pool_pop(m_pool, m_config.pool.blocking, &rc) : NULL,
-            bind(memcached_pool_push, m_pool, _1));
-        decompressor<lzo> inflate;
-        
-        if(!connection.valid()) {
-            return result;
+            return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
         }
-        
-        // Converting the key vector to a char pointer vector
-        std::vector<char*> key_values;
-        std::vector<size_t> key_sizes;
-        key_values.reserve(keys.size());
-        key_sizes.reserve(keys.size());
 
-        for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
-            if(it->empty()) {
-                continue;
+        memcached_st* connection;
+        uint32_t timeout;
+        bool expired;
+        uint64_t start, poll, connect;
+    };
+
+    namespace {
+        struct string_collector {
+            string_collector(string& result_):
+                result(result_) {}
+
+            void operator()(const string&, const char* value, size_t value_length, uint32_t, uint64_t) {
+                result.assign(value, value_length);
             }
 
-            key_values.push_back(const_cast<char*>(it->data()));
-            key_sizes.push_back(it->length());
+            string& result;
+        };
+
+        inline uint8_t traced_flags(uint32_t item_flags) {
+            if(item_flags & flags::chunked) {
+                return trace_flags::chunked;
+            }
+
+            return item_flags & flags::length_mask ? trace_flags::compressed : 0;
         }
 
-        // Querying
-        rc = memcached_mget(*connection, &key_values[0], &key_sizes[0], key_values.size());
-        if(rc != MEMCACHED_SUCCESS) {
-            LOG4CXX_ASSERT(m_log, rc == MEMCACHED_NOTFOUND, error(__func__, *connection, rc))
-            return result;
+        // The length before the compression, which the flags of the compressed values hold
+        inline size_t inflated_length(size_t length, uint32_t item_flags) {
+            return item_flags & flags::length_mask ? item_flags & flags::length_mask : length;
         }
 
-        // Fetching
-        wrap<memcached_result_st> ret(NULL, memcached_result_free); 
-        string k, v;
+        inline trace_op traced_op(store_fn_t store_fn) {
+            if(store_fn == memcached_add) {
+                return trace_add;
+            } else if(store_fn == memcached_replace) {
+                return trace_replace;
+            } else if(store_fn == memcached_append) {
+                return trace_append;
+            } else if(store_fn == memcached_prepend) {
+                return trace_prepend;
+            }
 
-        for(;;) {
-            ret = memcached_fetch_result(*connection, ret.release(), &rc);
-        
-            // So, according to the manual, we continue fetching until we get MEMCACHED_END,
-            // but in practice, we have to stop when we get anything except MEMCACHED_SUCCESS
-            // OR when we get invalid result pointer. This is how it's done in memcached_fetch()
-            if(rc != MEMCACHED_SUCCESS || !ret.valid()) {
-                LOG4CXX_ASSERT(m_log, rc == MEMCACHED_END, error(__func__, *connection, rc));
-                break;
+            return trace_set;
+        }
+
+        // Records a hit for every value passed on, and a miss for each of the other keys in the end
+        struct traced_fetch: private boost::noncopyable {
+            traced_fetch(tracer& tracer_, const cache_vector_t& keys_, fetch_fn_t fetch_fn_):
+                t(tracer_),
+                keys(keys_),
+                fetch_fn(fetch_fn_),
+                call(tracer_.begin()) {}
+
+            ~traced_fetch() {
+                for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+                    if(!it->empty() && seen.find(*it) == seen.end()) {
+                        t.record(call, trace_get_multi, *it, 0, 0, 0, MEMCACHED_NOTFOUND);
+                    }
+                }
             }
 
-            // Getting the key
-            k.assign(memcached_result_key_value(*ret), memcached_result_key_length(*ret));
+            // The callback only gets the decoded values, so the wire lengths and the flags
+            // of the values about to be passed on are told separately
+            void expect(const string& key, size_t length, uint32_t item_flags) {
+                expected[key] = make_pair(length, item_flags);
+            }
 
-            // Decompressing the value, if needed
-            if(memcached_result_flags(*ret)) {
-                if(inflate(memcached_result_value(*ret), memcached_result_length(*ret), memcached_result_flags(*ret))) {
-                    v.assign(inflate.data(), inflate.length());
-                } else {
-                    LOG4CXX_ERROR(m_log, boost::format("failed to decompress the value for key %1%") % k);
-                    continue;
+            void operator()(const string& key, const char* value, size_t value_length, uint32_t codec, uint64_t cas) {
+                map<string, pair<size_t, uint32_t> >::iterator it = expected.find(key);
+                size_t length = value_length;
+                uint32_t item_flags = 0;
+
+                if(it != expected.end()) {
+                    length = it->second.first;
+                    item_flags = it->second.second;
+                    expected.erase(it);
                 }
-            } else {
-                v.assign(memcached_result_value(*ret), memcached_result_length(*ret));
+
+                seen.insert(key);
+                t.record(call, trace_get_multi, key, length, value_length, traced_flags(item_flags), MEMCACHED_SUCCESS);
+                fetch_fn(key, value, value_length, codec, cas);
             }
-            
-            result.insert(make_pair(k, v));
-        }
 
-        return result;
-    }
+            tracer& t;
+            const cache_vector_t& keys;
+            fetch_fn_t fetch_fn;
+            trace_call call;
+            std::set<string> seen;
+            map<string, pair<size_t, uint32_t> > expected;
+        };
 
-    bool Client::store(store_fn_t store_fn, const string& key, const string& value, time_t expire) {
-        if(key.empty() || value.empty()) {
-            return false;
+        inline uint64_t generation() {
+            return (static_cast<uint64_t>(rand()) << 32) ^ rand() ^ time(NULL);
         }
 
-        cache_map_t cache_map = boost::assign::map_list_of(key, value);
-        store(store_fn, cache_map, expire);
+        // Reads a copy the way memcached_get() reads the primary
+        struct replica_get {
+            replica_get(const string& key_, wrap<char*>& value_, size_t& length_, uint32_t& item_flags_):
+                key(key_),
+                value(value_),
+                length(length_),
+                item_flags(item_flags_) {}
 
-        return cache_map.empty();
+            memcached_return_t operator()(memcached_st* connection, const string& route) const {
+                memcached_return_t rc;
+
+                value = memcached_get_by_key(connection, route.data(), route.length(), key.data(), key.length(),
+                    &length, &item_flags, &rc);
+
+                return rc;
+            }
+
+            const string& key;
+            wrap<char*>& value;
+            size_t& length;
+            uint32_t& item_flags;
+        };
+    }
+
+    string Client::get(const string& key, uint32_t timeout) {
+        string result;
+        get(key, string_collector(result), timeout);
+        return result;
     }
 
-    void Client::store(store_fn_t store_fn, cache_map_t& cache_map, time_t expire) {
+    void Client::get(const string& key, fetch_fn_t fetch_fn, uint32_t timeout) {
+        // Gets bounded by a timeout of their own are never held back
+        if(m_config.batching.window && !timeout && !key.empty()) {
+            if(!m_writer || !read_pending(key, fetch_fn)) {
+                batched_get(key, fetch_fn);
+            }
+
+            return;
+        }
+
         memcached_return_t rc;
-        wrap<memcached_st> connection(
-            m_pool ? memcached_pool_pop(m_pool, m_config.pool.blocking, &rc) : NULL,
-            bind(memcached_pool_push, m_pool, _1));
-        compressor<lzo> deflate;
+        wrap<char*> value(NULL, free);
+        size_t value_length;
+        uint32_t value_flags;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+        decompressor<lzo> inflate;
 
         if(!connection.valid()) {
             return;
         }
 
-        cache_map_t::iterator it = cache_map.begin();
-        bool compressed;
+        if(key.empty()) {
+            return;
+        }
 
-        while(it != cache_map.end()) {
-            if(it->first.empty() || it->second.empty()) {
-                ++it;
-                continue;
+        m_hot_keys.touch(key);
+
+        // Writes which haven't been sent yet are the freshest values there are
+        if(m_writer && read_pending(key, fetch_fn)) {
+            return;
+        }
+
+        string buffer;
+        const string& wire = wire_key(key, buffer);
+        trace_scope trace(m_tracer, trace_get, key);
+        deadline limit(*connection, timeout);
+
+        if(!limit.arm()) {
+            trace.rc = MEMCACHED_TIMEOUT;
+            return;
+        }
+
+        if(reachable(*connection, wire)) {
+            value = memcached_get(*connection, wire.data(), wire.length(),
+                &value_length, &value_flags, &rc);
+        } else {
+            rc = MEMCACHED_SERVER_MARKED_DEAD;
+        }
+
+        trace.rc = rc;
+
+        if(rc != MEMCACHED_SUCCESS) {
+            limit.check(rc);
+
+            if(rc == MEMCACHED_NOTFOUND || limit.expired) {
+                return;
             }
 
-            compressed = (it->second.length() > m_config.compression.threshold) ?
-                deflate(it->second.data(), it->second.length()) : false;
-                            
-            // Ternary abomination
-            rc = store_fn(*connection, it->first.data(), it->first.length(),
-                    compressed ? deflate.data() : it->second.data(),
-                    compressed ? deflate.length() : it->second.length(),
-                    expire ? expire : rand() % (m_config.expiration.maximum - m_config.expiration.minimum) + m_config.expiration.minimum,
-                    static_cast<uint64_t>(compressed ? it->second.length() : 0));
+            report(__func__, *connection, rc, wire);
 
-            if(rc == MEMCACHED_SUCCESS) {
-                cache_map.erase(it++);
+            // The primary server has failed, so trying the copies
+            rc = read_replicas(*connection, key, wire, rc, limit,
+                replica_get(wire, value, value_length, value_flags));
+            trace.rc = rc;
+
+            if(rc != MEMCACHED_SUCCESS) {
+                return;
+            }
+        }
+
+        trace.value_length = value_length;
+        trace.inflated_length = inflated_length(value_length, value_flags);
+        trace.flags = traced_flags(value_flags);
+
+        if(value_flags & flags::chunked) {
+            vector<chunked_value> pending(1, chunked_value(key, value_flags, 0));
+
+            if(pending.back().manifest.parse(*value, value_length)) {
+                trace.value_length = pending.back().manifest.length();
+                trace.inflated_length = inflated_length(trace.value_length, value_flags);
+                assemble(*connection, pending, fetch_fn, limit);
             } else {
-                LOG4CXX_ERROR(m_log, error(__func__, *connection, rc, it->first));
-                ++it;
+                LOG4CXX_ERROR(m_log, boost::format("invalid chunk manifest for key %1%") % key);
+            }
+        } else if(value_flags & flags::length_mask) {
+            if(inflate(*value, value_length, value_flags & flags::length_mask)) {
+                fetch_fn(key, inflate.data(), inflate.length(), value_flags & flags::codec_mask, 0);
+            } else {
+                LOG4CXX_ERROR(m_log, boost::format("failed to decompress the value for key %1%") % key);
             }
+        } else {
+            fetch_fn(key, *value, value_length, value_flags & flags::codec_mask, 0);
         }
     }
 
-    bool Client::remove(const string& key) {
-        if(key.empty()) {
-            return false;
-        }
-        
-        cache_vector_t cache_vector = boost::assign::list_of(key);
-        remove_multi(cache_vector);
-    
-        return cache_vector.empty();
+    value_buffer::value_buffer():
+        m_codec(0)
+    {
+        memcached_create(&m_memcached);
+        memcached_result_create(&m_memcached, &m_result);
     }
 
-    void Client::remove_multi(cache_vector_t& cache_vector) {
-        memcached_return_t rc;
-        wrap<memcached_st> connection(
-            m_pool ? memcached_pool_pop(m_pool, m_config.pool.blocking, &rc) : NULL,
-            bind(memcached_pool_push, m_pool, _1));
+    value_buffer::~value_buffer() {
+        memcached_result_free(&m_result);
+        memcached_free(&m_memcached);
+    }
 
-        if(!connection.valid()) {
-            return;
+    struct Client::get_batch: private boost::noncopyable {
+        struct value {
+            string data;
+            uint32_t codec;
+            uint64_t cas;
+        };
+
+        get_batch():
+            done(false) {}
+
+        void operator()(const string& key, const char* data, size_t length, uint32_t codec, uint64_t cas) {
+            value& target = values[key];
+
+            target.data.assign(data, length);
+            target.codec = codec;
+            target.cas = cas;
         }
 
-        cache_vector_t::iterator it = cache_vector.begin();
-        
-        while(it != cache_vector.end()) {
-            if(it->empty()) {
-                ++it;
+        cache_vector_t keys;
+        map<string, value> values;
+
+        // Guarded by the batch mutex of the client
+        boost::condition_variable full, finished;
+        boost::posix_time::ptime sent;
+        bool done;
+    };
+
+    void Client::batched_get(const string& key, fetch_fn_t fetch_fn) {
+        boost::posix_time::ptime queued = boost::posix_time::microsec_clock::universal_time();
+        boost::unique_lock<boost::mutex> lock(m_batch_mutex);
+        boost::shared_ptr<get_batch> batch = m_batch;
+
+        if(!batch) {
+            batch = m_batch = boost::make_shared<get_batch>();
+        }
+
+        batch->keys.push_back(key);
+
+        // The next caller starts a batch of its own
+        if(batch->keys.size() >= m_config.batching.size) {
+            m_batch.reset();
+            batch->full.notify_one();
+        }
+
+        if(batch->keys.size() == 1) {
+            // The first caller waits for the others and sends the batch for everyone
+            boost::system_time until = boost::get_system_time() +
+                boost::posix_time::microseconds(m_config.batching.window);
+
+            while(m_batch == batch && batch->full.timed_wait(lock, until)) {}
+
+            if(m_batch == batch) {
+                m_batch.reset();
             }
 
-            rc = memcached_delete(*connection, it->data(), it->length(), static_cast<time_t>(0));
-            
-            if(rc == MEMCACHED_SUCCESS || rc == MEMCACHED_NOTFOUND) {
-                it = cache_vector.erase(it);
-            } else {
-                LOG4CXX_ERROR(m_log, error(__func__, *connection, rc, *it));
-                ++it;
+            batch->sent = boost::posix_time::microsec_clock::universal_time();
+            lock.unlock();
+
+            // The same key might have been requested by several callers
+            std::set<string> unique(batch->keys.begin(), batch->keys.end());
+            cache_vector_t keys(unique.begin(), unique.end());
+
+            try {
+                fetch(keys, boost::ref(*batch));
+            } catch(...) {
+                lock.lock();
+                batch->done = true;
+                batch->finished.notify_all();
+                throw;
             }
-        }
-    }
 
-    void Client::flush() {
-        memcached_return_t rc;
-        wrap<memcached_st> connection(
-            m_pool ? memcached_pool_pop(m_pool, m_config.pool.blocking, &rc) : NULL,
-            bind(memcached_pool_push, m_pool, _1));
+            lock.lock();
 
-        if(!connection.valid()) {
-            return;
+            uint32_t bucket = 0;
+
+            while(bucket < 31 && (2u << bucket) <= batch->keys.size()) {
+                bucket++;
+            }
+
+            m_batch_stats.sizes[bucket]++;
+            m_batch_stats.calls += batch->keys.size();
+            m_batch_stats.keys += keys.size();
+
+            batch->done = true;
+            batch->finished.notify_all();
+        } else {
+            while(!batch->done) {
+                batch->finished.wait(lock);
+            }
         }
 
-        rc = memcached_flush(*connection, static_cast<time_t>(0));
+        uint64_t waited = std::max<int64_t>((batch->sent - queued).total_microseconds(), 0);
 
-        LOG4CXX_ASSERT(m_log, rc == MEMCACHED_SUCCESS,
-            error(__func__, *connection, rc));
-    }
+        m_batch_stats.waited += waited;
+        m_batch_stats.longest = std::max(m_batch_stats.longest, waited);
 
-    namespace {
-        static memcached_return_t collector(
-                memcached_server_instance_st instance,
-                const char* key, size_t key_length,
-                const char* value, size_t value_length,
-                void* context)
-        {
-            boost::format name = boost::format("%1%:%2%") %
-                memcached_server_name(instance) %
-                memcached_server_port(instance);
+        lock.unlock();
 
-            stats_t* stats = reinterpret_cast<stats_t*>(context);
-            cache_map_t& counters = (*stats)[name.str()];
-            
-            counters.insert(std::make_pair(
-                std::string(key, key_length),
-                std::string(value, value_length)));
+        // The values are only read from now on, so the callbacks are run outside of the lock
+        map<string, get_batch::value>::const_iterator it = batch->values.find(key);
 
-            return MEMCACHED_SUCCESS;
+        if(it != batch->values.end()) {
+            fetch_fn(key, it->second.data.data(), it->second.data.length(), it->second.codec, it->second.cas);
         }
     }
 
-    stats_t Client::get_stats() {
-        memcached_return_t rc;
-        wrap<memcached_st> connection(
-            m_pool ? memcached_pool_pop(m_pool, m_config.pool.blocking, &rc) : NULL,
-            bind(memcached_pool_push, m_pool, _1));
-        stats_t result;
-    
-        if(!connection.valid()) {
-            return result;
-        }
+    counters_t Client::get_batch_stats() {
+        boost::lock_guard<boost::mutex> lock(m_batch_mutex);
+        counters_t result = boost::assign::map_list_of
+            ("calls", m_batch_stats.calls)
+            ("keys", m_batch_stats.keys)
+            ("wait-total", m_batch_stats.waited)
+            ("wait-max", m_batch_stats.longest);
 
-        memcached_stat_execute(*connection, NULL, collector, &result);
+        for(uint32_t i = 0; i < 32; ++i) {
+            if(m_batch_stats.sizes[i]) {
+                result[(boost::format("batches-%1%") % (static_cast<uint64_t>(1) << i)).str()] = m_batch_stats.sizes[i];
+            }
+        }
 
         return result;
     }
 
-    boost::format Client::error(const char* function, const memcached_st* connection, memcached_return_t code, const string& key) const {
+    struct Client::buffer_collector {
+        buffer_collector(value_buffer& buffer_):
+            buffer(buffer_) {}
+
+        void operator()(const string&, const char* value, size_t value_length, uint32_t codec, uint64_t) {
+            buffer.m_value.assign(value, value_length);
+            buffer.m_codec = codec;
+        }
+
+        value_buffer& buffer;
+    };
+
+    bool Client::get_into(const string& key, value_buffer& buffer, uint32_t timeout) {
         memcached_return_t rc;
-        memcached_server_instance_st server = NULL;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
 
-        if(code == MEMCACHED_SERVER_MARKED_DEAD) {
-            server = memcached_server_get_last_disconnect(connection);
-        } else if (!key.empty()) {
-            server = memcached_server_by_key(connection, key.data(), key.length(), &rc);
+        buffer.m_value.clear();
+        buffer.m_codec = 0;
+
+        if(!connection.valid() || key.empty()) {
+            return false;
         }
 
-        if(server) {
-            return boost::format("%1% failed for key %2%: %3% on %4%") %
-                function %
-                key %
-                memcached_strerror(const_cast<memcached_st*>(connection), code) %
-                server->hostname;
+        m_hot_keys.touch(key);
+
+        if(m_writer && read_pending(key, buffer_collector(buffer))) {
+            return true;
+        }
+
+        string digest;
+        const string& wire = wire_key(key, digest);
+        trace_scope trace(m_tracer, trace_get, key);
+        deadline limit(*connection, timeout);
+
+        if(!limit.arm()) {
+            trace.rc = MEMCACHED_TIMEOUT;
+            return false;
+        }
+
+        rc = reachable(*connection, wire) ? receive(*connection, wire, wire, &buffer.m_result) :
+            MEMCACHED_SERVER_MARKED_DEAD;
+        trace.rc = rc;
+
+        if(rc != MEMCACHED_SUCCESS) {
+            limit.check(rc);
+
+            if(rc == MEMCACHED_NOTFOUND || limit.expired) {
+                return false;
+            }
+
+            report(__func__, *connection, rc, wire);
+
+            // The primary server has failed, so trying the copies
+            rc = read_replicas(*connection, key, wire, rc, limit,
+                boost::bind(&Client::receive, this, _1, _2, boost::cref(wire), &buffer.m_result));
+            trace.rc = rc;
+
+            if(rc != MEMCACHED_SUCCESS) {
+                return false;
+            }
+        }
+
+        const char* value = memcached_result_value(&buffer.m_result);
+        size_t value_length = memcached_result_length(&buffer.m_result);
+        uint32_t value_flags = memcached_result_flags(&buffer.m_result);
+
+        trace.value_length = value_length;
+        trace.inflated_length = inflated_length(value_length, value_flags);
+        trace.flags = traced_flags(value_flags);
+        vector<chunked_value> pending;
+        bool found = true;
+
+        if(value_flags & flags::chunked) {
+            pending.push_back(chunked_value(key, value_flags, 0));
+
+            if(!pending.back().manifest.parse(value, value_length)) {
+                LOG4CXX_ERROR(m_log, boost::format("invalid chunk manifest for key %1%") % key);
+                pending.clear();
+                found = false;
+            }
+        } else if(value_flags & flags::length_mask) {
+            buffer.m_value.resize(value_flags & flags::length_mask);
+
+            if(!decompress(value, value_length, &buffer.m_value[0], buffer.m_value.length())) {
+                LOG4CXX_ERROR(m_log, boost::format("failed to decompress the value for key %1%") % key);
+                found = false;
+            }
+        } else {
+            buffer.m_value.assign(value, value_length);
+        }
+
+        buffer.m_codec = value_flags & flags::codec_mask;
+
+        // Reading up to the end of the response, which resets the result
+        while(memcached_fetch_result(*connection, &buffer.m_result, &rc)) {}
+
+        // Chunked values are assembled as usual, with the copies that takes
+        if(!pending.empty()) {
+            assemble(*connection, pending, buffer_collector(buffer), limit);
+            found = !buffer.m_value.empty();
+        }
+
+        if(!found) {
+            buffer.m_value.clear();
+        }
+
+        return found;
+    }
+
+    memcached_return_t Client::receive(memcached_st* connection, const string& route, const string& key,
+        memcached_result_st* result)
+    {
+        memcached_return_t rc;
+        const char* keys[] = { key.data() };
+        size_t lengths[] = { key.length() };
+
+        rc = memcached_mget_by_key(connection, route.data(), route.length(), keys, lengths, 1);
+
+        if(rc != MEMCACHED_SUCCESS) {
+            return rc;
+        }
+
+        memcached_fetch_result(connection, result, &rc);
+
+        return rc == MEMCACHED_END ? MEMCACHED_NOTFOUND : rc;
+    }
+
+    namespace {
+        struct value_collector {
+            value_collector(cache_map_t& result_):
+                result(result_) {}
+
+            void operator()(const string& key, const char* value, size_t value_length, uint32_t, uint64_t) {
+                result.insert(make_pair(key, string(value, value_length)));
+            }
+
+            cache_map_t& result;
+        };
+
+        struct cas_collector {
+            cas_collector(cas_map_t& result_):
+                result(result_) {}
+
+            void operator()(const string& key, const char* value, size_t value_length, uint32_t, uint64_t cas) {
+                result.insert(make_pair(key, make_pair(string(value, value_length), cas)));
+            }
+
+            cas_map_t& result;
+        };
+    }
+
+    cache_map_t Client::get_multi(const cache_vector_t& keys) {
+        cache_map_t result;
+        fetch(keys, value_collector(result));
+        return result;
+    }
+
+    cache_map_t Client::get_multi(const cache_vector_t& keys, uint32_t timeout, cache_vector_t& timedout) {
+        cache_map_t result;
+        fetch(keys, value_collector(result), timeout, &timedout);
+        return result;
+    }
+
+    cas_value_t Client::gets(const string& key) {
+        cas_map_t result;
+        
+        if(key.empty()) {
+            return cas_value_t();
+        }
+
+        settle(key);
+        fetch(boost::assign::list_of(key), cas_collector(result));
+
+        return result.empty() ? cas_value_t() : result.begin()->second;
+    }
+
+    cas_map_t Client::gets_multi(const cache_vector_t& keys) {
+        cas_map_t result;
+        gets_multi(keys, cas_collector(result));
+        return result;
+    }
+
+    void Client::gets_multi(const cache_vector_t& keys, fetch_fn_t fetch_fn) {
+        // The CAS values have to come from the server
+        settle(keys);
+        fetch(keys, fetch_fn);
+    }
+
+    bool Client::fetch(const cache_vector_t& requested, fetch_fn_t fetch_fn, uint32_t timeout, cache_vector_t* timedout) {
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+        decompressor<lzo> inflate;
+        
+        if(!connection.valid()) {
+            return false;
+        }
+
+        // The callback is intercepted to tell the hits from the misses
+        boost::scoped_ptr<traced_fetch> traced(m_tracer.enabled() ? new traced_fetch(m_tracer, requested, fetch_fn) : NULL);
+
+        if(traced) {
+            fetch_fn = boost::ref(*traced);
+        }
+
+        if(m_config.hot_keys.capacity) {
+            for(cache_vector_t::const_iterator it = requested.begin(); it != requested.end(); ++it) {
+                m_hot_keys.touch(*it);
+            }
+        }
+
+        // Only the keys with no pending writes go to the servers
+        cache_vector_t remaining;
+        const cache_vector_t& keys = m_writer ? read_pending(requested, fetch_fn, remaining) : requested;
+        
+        // Converting the key vector to a char pointer vector
+        std::vector<char*> key_values;
+        std::vector<size_t> key_sizes;
+        key_values.reserve(keys.size());
+        key_sizes.reserve(keys.size());
+
+        // Digested keys are mapped back to the original ones
+        vector<string> digests;
+        map<string, string> originals;
+        string buffer;
+        bool skipped = false;
+
+        for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            if(it->empty()) {
+                continue;
+            }
+
+            const string& wire = wire_key(*it, buffer);
+
+            // The copies answer with the digested keys as well
+            if(&wire != &*it) {
+                originals.insert(make_pair(wire, *it));
+            }
+
+            // Keys of the servers which are down are only looked up on their copies, if any
+            if(!reachable(*connection, wire)) {
+                skipped = true;
+                continue;
+            }
+
+            if(&wire != &*it) {
+                if(digests.empty()) {
+                    digests.reserve(keys.size());
+                }
+
+                digests.push_back(wire);
+            }
+
+            key_values.push_back(const_cast<char*>(&wire == &*it ? it->data() : digests.back().data()));
+            key_sizes.push_back(wire.length());
+        }
+
+        // Keys on the failed servers are looked up on their copies, rank by rank
+        boost::shared_ptr<const policy_table> table = policies();
+        uint32_t factor = table->replication();
+        bool replicated = factor > 1, failed = skipped;
+        map<uint32_t, pair<string, cache_vector_t> > requests;
+        map<uint32_t, pair<string, cache_vector_t> >::const_iterator request = requests.end();
+        uint32_t rank = 0;
+
+        if(key_values.empty() && !(skipped && replicated)) {
+            return !skipped;
+        }
+
+        deadline limit(*connection, timeout);
+
+        // Keys which have been answered, to tell the late ones when the time is up
+        std::set<string> answered;
+
+        // Querying, unless every key is on a server which is down
+        if(key_values.empty()) {
+            rc = MEMCACHED_SERVER_MARKED_DEAD;
+        } else if(limit.arm()) {
+            rc = memcached_mget(*connection, &key_values[0], &key_sizes[0], key_values.size());
+            limit.check(rc);
+        } else {
+            rc = MEMCACHED_TIMEOUT;
+        }
+
+        // The rest of the servers are still queried
+        if(rc == MEMCACHED_SOME_ERRORS) {
+            report(__func__, *connection, rc);
+            failed = true;
+        } else if(rc != MEMCACHED_SUCCESS) {
+            if(!key_values.empty() && rc != MEMCACHED_NOTFOUND && !limit.expired) {
+                report(__func__, *connection, rc);
+            }
+
+            // When no server could be asked at all, the copies still can
+            if(replicated && rc != MEMCACHED_NOTFOUND && !limit.expired) {
+                failed = true;
+            } else {
+                if(timedout && limit.expired) {
+                    for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+                        if(!it->empty()) {
+                            timedout->push_back(*it);
+                        }
+                    }
+                }
+
+                return rc == MEMCACHED_NOTFOUND;
+            }
+        }
+
+        // Fetching
+        wrap<memcached_result_st> ret(NULL, memcached_result_free); 
+        vector<chunked_value> pending;
+        uint32_t value_flags;
+        string k;
+
+        for(bool querying = (rc == MEMCACHED_SUCCESS || rc == MEMCACHED_SOME_ERRORS);; ) {
+            while(querying && limit.arm()) {
+                ret = memcached_fetch_result(*connection, ret.release(), &rc);
+        
+                // So, according to the manual, we continue fetching until we get MEMCACHED_END,
+                // but in practice, we have to stop when we get anything except MEMCACHED_SUCCESS
+                // OR when we get invalid result pointer. This is how it's done in memcached_fetch()
+                if(rc != MEMCACHED_SUCCESS || !ret.valid()) {
+                    limit.check(rc);
+
+                    if(rc != MEMCACHED_END && !limit.expired) {
+                        report(__func__, *connection, rc);
+                        failed = true;
+                    }
+                    break;
+                }
+
+                // Getting the key
+                k.assign(memcached_result_key_value(*ret), memcached_result_key_length(*ret));
+
+                if(!originals.empty()) {
+                    map<string, string>::const_iterator original = originals.find(k);
+
+                    if(original != originals.end()) {
+                        k = original->second;
+                    }
+                }
+
+                if((timedout && timeout) || replicated) {
+                    answered.insert(k);
+                }
+
+                value_flags = memcached_result_flags(*ret);
+
+                // Postponing the chunked values until all the manifests are here
+                if(value_flags & flags::chunked) {
+                    pending.push_back(chunked_value(k, value_flags, memcached_result_cas(*ret)));
+
+                    if(!pending.back().manifest.parse(memcached_result_value(*ret), memcached_result_length(*ret))) {
+                        LOG4CXX_ERROR(m_log, boost::format("invalid chunk manifest for key %1%") % k);
+                        pending.pop_back();
+                    } else if(traced) {
+                        traced->expect(k, pending.back().manifest.length(), value_flags);
+                    }
+
+                    continue;
+                }
+
+                if(traced) {
+                    traced->expect(k, memcached_result_length(*ret), value_flags);
+                }
+
+                // Decompressing the value, if needed
+                if(value_flags & flags::length_mask) {
+                    if(inflate(memcached_result_value(*ret), memcached_result_length(*ret), value_flags & flags::length_mask)) {
+                        fetch_fn(k, inflate.data(), inflate.length(), value_flags & flags::codec_mask,
+                            memcached_result_cas(*ret));
+                    } else {
+                        LOG4CXX_ERROR(m_log, boost::format("failed to decompress the value for key %1%") % k);
+                    }
+                } else {
+                    fetch_fn(k, memcached_result_value(*ret), memcached_result_length(*ret),
+                        value_flags & flags::codec_mask, memcached_result_cas(*ret));
+                }
+            }
+
+            if(!replicated || limit.expired) {
+                break;
+            }
+
+            if(request == requests.end()) {
+                if(!failed || ++rank >= factor) {
+                    break;
+                }
+
+                fallback(*connection, *table, keys, answered, rank, requests);
+                request = requests.begin();
+
+                // The keys left have no copies to ask, so the failure stands
+                if(request == requests.end()) {
+                    break;
+                }
+
+                failed = false;
+            }
+
+            // The keys of a request are all on the same server, so its routing key does for all of them
+            key_values.clear();
+            key_sizes.clear();
+
+            for(cache_vector_t::const_iterator it = request->second.second.begin(); it != request->second.second.end(); ++it) {
+                key_values.push_back(const_cast<char*>(it->data()));
+                key_sizes.push_back(it->length());
+            }
+
+            rc = !limit.arm() ? MEMCACHED_TIMEOUT :
+                memcached_mget_by_key(*connection, request->second.first.data(), request->second.first.length(),
+                    &key_values[0], &key_sizes[0], key_values.size());
+            limit.check(rc);
+
+            querying = (rc == MEMCACHED_SUCCESS);
+            failed = failed || !querying;
+            ++request;
+        }
+
+        if(!pending.empty()) {
+            assemble(*connection, pending, fetch_fn, limit);
+        }
+
+        if(!timedout || !limit.expired) {
+            return !failed && !limit.expired;
+        }
+
+        // Values which couldn't be assembled in time are late as well
+        for(vector<chunked_value>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+            if(it->received != it->manifest.count()) {
+                answered.erase(it->key);
+            }
+        }
+
+        for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            if(!it->empty() && answered.find(*it) == answered.end()) {
+                timedout->push_back(*it);
+            }
+        }
+
+        return false;
+    }
+
+    void Client::fallback(const memcached_st* connection, const policy_table& table, const cache_vector_t& keys,
+        const std::set<string>& answered, uint32_t rank, map<uint32_t, pair<string, cache_vector_t> >& requests) const
+    {
+        boost::shared_ptr<const cache_vector_t> routing = routes();
+        vector<uint32_t> servers;
+        string buffer;
+
+        requests.clear();
+
+        for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            if(it->empty() || answered.find(*it) != answered.end()) {
+                continue;
+            }
+
+            const string& wire = wire_key(*it, buffer);
+
+            replicas(connection, wire, replication(table, *it), servers);
+
+            if(servers.size() <= rank) {
+                continue;
+            }
+
+            pair<string, cache_vector_t>& request = requests[servers[rank]];
+
+            if(!request.first.empty() || routing_key(*routing, servers[rank], request.first)) {
+                request.second.push_back(wire);
+            }
+        }
+
+        // Servers no routing key has been found for
+        for(map<uint32_t, pair<string, cache_vector_t> >::iterator it = requests.begin(); it != requests.end(); ) {
+            if(it->second.second.empty()) {
+                requests.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void Client::assemble(memcached_st* connection, vector<chunked_value>& pending, fetch_fn_t fetch_fn,
+        deadline& limit)
+    {
+        memcached_return_t rc;
+        decompressor<lzo> inflate;
+        map<string, pair<size_t, uint32_t> > chunks;
+        vector<string> keys;
+        string buffer;
+
+        // Preallocating the buffers and collecting the chunk keys for all the values,
+        // so that they are fetched in one go
+        for(size_t i = 0; i < pending.size(); ++i) {
+            pending[i].payload.resize(pending[i].manifest.length());
+
+            for(uint32_t chunk = 0; chunk < pending[i].manifest.count(); ++chunk) {
+                pending[i].manifest.key(pending[i].key, chunk, buffer);
+                keys.push_back(buffer);
+                chunks.insert(make_pair(keys.back(), make_pair(i, chunk)));
+            }
+        }
+
+        std::vector<const char*> key_values;
+        std::vector<size_t> key_sizes;
+        key_values.reserve(keys.size());
+        key_sizes.reserve(keys.size());
+
+        for(vector<string>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            key_values.push_back(it->data());
+            key_sizes.push_back(it->length());
+        }
+
+        if(!limit.arm()) {
+            return;
+        }
+
+        rc = memcached_mget(connection, &key_values[0], &key_sizes[0], key_values.size());
+        if(rc != MEMCACHED_SUCCESS) {
+            limit.check(rc);
+
+            if(rc != MEMCACHED_NOTFOUND && !limit.expired) {
+                report(__func__, connection, rc);
+            }
+            return;
+        }
+
+        wrap<memcached_result_st> ret(NULL, memcached_result_free);
+        map<string, pair<size_t, uint32_t> >::const_iterator chunk;
+        string k;
+
+        while(limit.arm()) {
+            ret = memcached_fetch_result(connection, ret.release(), &rc);
+
+            if(rc != MEMCACHED_SUCCESS || !ret.valid()) {
+                limit.check(rc);
+
+                if(rc != MEMCACHED_END && !limit.expired) {
+                    report(__func__, connection, rc);
+                }
+                break;
+            }
+
+            k.assign(memcached_result_key_value(*ret), memcached_result_key_length(*ret));
+            chunk = chunks.find(k);
+
+            if(chunk == chunks.end()) {
+                continue;
+            }
+
+            chunked_value& value = pending[chunk->second.first];
+
+            if(memcached_result_length(*ret) != value.manifest.length(chunk->second.second)) {
+                LOG4CXX_ERROR(m_log, boost::format("chunk %1% has unexpected length") % k);
+                continue;
+            }
+
+            memcpy(&value.payload[value.manifest.offset(chunk->second.second)],
+                memcached_result_value(*ret), memcached_result_length(*ret));
+            value.received++;
+        }
+
+        for(vector<chunked_value>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+            // Partially written, evicted or overwritten values are treated as misses
+            if(it->received != it->manifest.count() || !it->manifest.verify(it->payload.data(), it->payload.length())) {
+                LOG4CXX_ASSERT(m_log, limit.expired,
+                    boost::format("chunked value for key %1% is incomplete") % it->key);
+                continue;
+            }
+
+            if(it->flags & flags::length_mask) {
+                if(inflate(it->payload.data(), it->payload.length(), it->flags & flags::length_mask)) {
+                    fetch_fn(it->key, inflate.data(), inflate.length(), it->flags & flags::codec_mask, it->cas);
+                } else {
+                    LOG4CXX_ERROR(m_log, boost::format("failed to decompress the value for key %1%") % it->key);
+                }
+            } else {
+                fetch_fn(it->key, it->payload.data(), it->payload.length(), it->flags & flags::codec_mask, it->cas);
+            }
+        }
+    }
+
+    namespace {
+        // Operations on the copies, which are addressed with the routing keys
+        struct replica_set {
+            replica_set(const char* data_, size_t length_, time_t expire_, uint32_t flags_):
+                data(data_),
+                length(length_),
+                expire(expire_),
+                flags(flags_) {}
+
+            memcached_return_t operator()(memcached_st* connection, const char* route, size_t route_length,
+                const char* key, size_t key_length) const
+            {
+                return memcached_set_by_key(connection, route, route_length, key, key_length,
+                    data, length, expire, flags);
+            }
+
+            const char* data;
+            size_t length;
+            time_t expire;
+            uint32_t flags;
+        };
+
+        struct replica_delete {
+            memcached_return_t operator()(memcached_st* connection, const char* route, size_t route_length,
+                const char* key, size_t key_length) const
+            {
+                return memcached_delete_by_key(connection, route, route_length, key, key_length, 0);
+            }
+        };
+
+        struct replica_touch {
+            replica_touch(time_t expire_):
+                expire(expire_) {}
+
+            memcached_return_t operator()(memcached_st* connection, const char* route, size_t route_length,
+                const char* key, size_t key_length) const
+            {
+                return memcached_touch_by_key(connection, route, route_length, key, key_length, expire);
+            }
+
+            time_t expire;
+        };
+
+        struct cas_fn {
+            cas_fn(uint64_t cas_):
+                cas(cas_) {}
+
+            memcached_return_t operator()(memcached_st* connection, const char* key, size_t key_length,
+                const char* value, size_t value_length, time_t expire, uint32_t flags) const
+            {
+                return memcached_cas(connection, key, key_length, value, value_length, expire, flags, cas);
+            }
+
+            uint64_t cas;
+        };
+
+        // Whether the value can be written to the copies without looking at the primary one
+        inline bool unconditional(store_fn_t store_fn) {
+            return store_fn == memcached_set;
+        }
+
+        inline bool unconditional(const cas_fn&) {
+            return false;
+        }
+
+        // The manifests among the values of the keys, by key
+        void fetch_manifests(memcached_st* connection, const cache_vector_t& keys,
+            map<string, helpers::manifest>& result)
+        {
+            vector<const char*> key_values;
+            vector<size_t> key_sizes;
+
+            for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+                key_values.push_back(it->data());
+                key_sizes.push_back(it->length());
+            }
+
+            if(key_values.empty()) {
+                return;
+            }
+
+            memcached_return_t rc = memcached_mget(connection, &key_values[0], &key_sizes[0], key_values.size());
+
+            if(rc != MEMCACHED_SUCCESS && rc != MEMCACHED_SOME_ERRORS) {
+                return;
+            }
+
+            wrap<memcached_result_st> ret(NULL, memcached_result_free);
+            helpers::manifest manifest;
+
+            while(true) {
+                ret = memcached_fetch_result(connection, ret.release(), &rc);
+
+                if(rc != MEMCACHED_SUCCESS || !ret.valid()) {
+                    break;
+                }
+
+                if((memcached_result_flags(*ret) & flags::chunked) &&
+                    manifest.parse(memcached_result_value(*ret), memcached_result_length(*ret)))
+                {
+                    result[string(memcached_result_key_value(*ret), memcached_result_key_length(*ret))] = manifest;
+                }
+            }
+        }
+    }
+
+    bool Client::store(store_fn_t store_fn, const string& key, const string& value, time_t expire,
+        uint32_t codec, bool compressible, uint32_t timeout)
+    {
+        if(key.empty() || value.empty()) {
+            return false;
+        }
+
+        cache_map_t cache_map = boost::assign::map_list_of(key, value);
+        store(store_fn, cache_map, expire, codec, compressible, timeout);
+
+        return cache_map.empty();
+    }
+
+    namespace {
+        // Compresses the value when it's over the threshold and it's worth it,
+        // returning the item flags, i.e. the inflated length or zero
+        inline uint32_t encode(compressor<lzo>& deflate, const string& value, uint32_t threshold,
+            const char*& data, size_t& length)
+        {
+            if(value.length() > threshold && value.length() <= flags::length_mask &&
+                deflate(value.data(), value.length()))
+            {
+                data = deflate.data();
+                length = deflate.length();
+                return value.length();
+            }
+
+            data = value.data();
+            length = value.length();
+            return 0;
+        }
+    }
+
+    void Client::store(store_fn_t store_fn, cache_map_t& cache_map, time_t expire, uint32_t codec, bool compressible,
+        uint32_t timeout)
+    {
+        // Direct writes supersede the pending ones. Settling waits for the writer, which needs
+        // a connection of its own, so it's done before taking one
+        if(m_writer) {
+            cache_vector_t keys;
+
+            keys.reserve(cache_map.size());
+
+            for(cache_map_t::const_iterator key = cache_map.begin(); key != cache_map.end(); ++key) {
+                keys.push_back(key->first);
+            }
+
+            settle(keys);
+        }
+
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+        compressor<lzo> deflate;
+
+        if(!connection.valid()) {
+            return;
+        }
+
+        boost::shared_ptr<const policy_table> table = policies();
+        cache_map_t::iterator it = cache_map.begin();
+        const char* data;
+        size_t length;
+        uint32_t flags;
+        string buffer;
+
+        deadline limit(*connection, timeout);
+
+        // Items which didn't make it in time are left in the map as failed
+        while(it != cache_map.end() && limit.arm()) {
+            if(it->first.empty() || it->second.empty()) {
+                ++it;
+                continue;
+            }
+
+            trace_call call = m_tracer.begin();
+            const policy& rules = table->resolve(it->first);
+
+            flags = encode(deflate, it->second,
+                compressible ? rules.compression_threshold : numeric_limits<uint32_t>::max(),
+                data, length) | (codec & flags::codec_mask);
+
+            // Concatenated values can't be chunked either, for the same reason
+            if(compressible) {
+                rc = put(*connection, store_fn, it->first, rules.replication_factor, data, length, rules.expiration(expire),
+                    flags, &limit);
+            } else {
+                const string& wire = wire_key(it->first, buffer);
+
+                rc = !reachable(*connection, wire) ? MEMCACHED_SERVER_MARKED_DEAD :
+                    store_fn(*connection, wire.data(), wire.length(), data, length, rules.expiration(expire), flags);
+
+                // Concatenations aren't replicated either, and the copies go even when they fail
+                replicate(*connection, wire, rules.replication_factor, replica_delete());
+            }
+
+            limit.check(rc);
+
+            if(call.id) {
+                m_tracer.record(call, traced_op(store_fn), it->first, length, it->second.length(), traced_flags(flags), rc);
+            }
+
+            if(rc == MEMCACHED_SUCCESS) {
+                cache_map.erase(it++);
+            } else {
+                if(!limit.expired) {
+                    report(__func__, *connection, rc, wire_key(it->first, buffer));
+                }
+                ++it;
+            }
+        }
+    }
+
+    template<typename StoreFn>
+    memcached_return_t Client::put(memcached_st* connection, StoreFn store_fn, const string& key, uint32_t factor,
+        const char* data, size_t length, time_t expire, uint32_t flags, deadline* limit)
+    {
+        memcached_return_t rc;
+        string buffer;
+        const string& wire = wire_key(key, buffer);
+        bool chunked = m_config.chunking.size && length > m_config.chunking.size;
+
+        if(!reachable(connection, wire)) {
+            rc = MEMCACHED_SERVER_MARKED_DEAD;
+        } else if(!chunked) {
+            rc = store_fn(connection, wire.data(), wire.length(), data, length, expire, flags);
+        } else {
+            // Chunks go first, so that the manifest never references missing ones,
+            // unless they got evicted, which is detected when reassembling
+            helpers::manifest manifest(data, length, m_config.chunking.size, generation());
+            string chunk_key;
+            uint32_t stored = 0;
+
+            rc = MEMCACHED_SUCCESS;
+
+            for(; stored < manifest.count() && (rc == MEMCACHED_SUCCESS || rc == MEMCACHED_BUFFERED); ++stored) {
+                manifest.key(key, stored, chunk_key);
+
+                rc = limit && !limit->arm() ? MEMCACHED_TIMEOUT :
+                    memcached_set(connection, chunk_key.data(), chunk_key.length(),
+                        data + manifest.offset(stored), manifest.length(stored), expire, 0);
+            }
+
+            if(rc == MEMCACHED_SUCCESS || rc == MEMCACHED_BUFFERED) {
+                string body = manifest.serialize();
+
+                rc = limit && !limit->arm() ? MEMCACHED_TIMEOUT :
+                    store_fn(connection, wire.data(), wire.length(), body.data(), body.length(),
+                        expire, flags | flags::chunked);
+            }
+
+            // No manifest will ever reference the chunks of a failed write, as the generation
+            // is new, so they're dropped rather than left to take up the memory till they expire
+            if(rc != MEMCACHED_SUCCESS && rc != MEMCACHED_BUFFERED) {
+                for(uint32_t chunk = 0; chunk < stored; ++chunk) {
+                    manifest.key(key, chunk, chunk_key);
+                    memcached_delete(connection, chunk_key.data(), chunk_key.length(), 0);
+                }
+            }
+        }
+
+        // Pipelined writes are only acknowledged later on. Whether or not the primary server
+        // took the value, the copies must not keep an outdated one for the reads falling back
+        // to them, so they get the new value, or are dropped when it can't be written there
+        // blindly. Chunked values aren't replicated, so their copies always go
+        if(!chunked && (rc == MEMCACHED_SUCCESS || rc == MEMCACHED_BUFFERED || unconditional(store_fn))) {
+            replicate(connection, wire, factor, replica_set(data, length, expire, flags));
+        } else {
+            replicate(connection, wire, factor, replica_delete());
+        }
+
+        return rc;
+    }
+
+    bool Client::set_async(const string& key, const string& value, time_t expire, uint32_t codec) {
+        if(key.empty() || value.empty()) {
+            return false;
+        }
+
+        cache_map_t cache_map = boost::assign::map_list_of(key, value);
+        set_multi_async(cache_map, expire, codec);
+
+        return cache_map.empty();
+    }
+
+    void Client::set_multi_async(cache_map_t& cache_map, time_t expire, uint32_t codec) {
+        if(!m_writer) {
+            set_multi(cache_map, expire, codec);
+            return;
+        }
+
+        // Namespaces which aren't eligible for write-behind are written right away
+        boost::shared_ptr<const policy_table> table = policies();
+        cache_map_t immediate;
+
+        for(cache_map_t::iterator item = cache_map.begin(); item != cache_map.end(); ) {
+            if(!table->resolve(item->first).write_behind) {
+                immediate.insert(*item);
+                cache_map.erase(item++);
+            } else {
+                ++item;
+            }
+        }
+
+        if(!immediate.empty()) {
+            set_multi(immediate, expire, codec);
+        }
+
+        if(!cache_map.empty()) {
+            queue_writes(*table, cache_map, expire, codec);
+        }
+
+        // The failed ones are left in the map, just like the dropped ones, but only now,
+        // so that they're not queued for write-behind after all
+        cache_map.insert(immediate.begin(), immediate.end());
+    }
+
+    void Client::queue_writes(const policy_table& table, cache_map_t& cache_map, time_t expire, uint32_t codec) {
+        boost::unique_lock<boost::mutex> lock(m_pending_mutex);
+        boost::system_time until = boost::get_system_time() +
+            boost::posix_time::milliseconds(m_config.write_behind.wait);
+        cache_map_t::iterator it = cache_map.begin();
+
+        while(it != cache_map.end()) {
+            if(it->first.empty() || it->second.empty()) {
+                ++it;
+                continue;
+            }
+
+            pending_map_t::iterator pending = m_pending.find(it->first);
+
+            if(pending != m_pending.end()) {
+                // Only the latest value is worth sending
+                m_write_stats.coalesced++;
+            } else {
+                // When the queue is full, the caller waits for a while and then gives up on the item
+                while(m_pending.size() >= m_config.write_behind.limit && !m_stopping &&
+                    m_room.timed_wait(lock, until)) {}
+
+                if(m_pending.size() >= m_config.write_behind.limit || m_stopping) {
+                    m_write_stats.dropped++;
+                    ++it;
+                    continue;
+                }
+
+                pending = m_pending.insert(make_pair(it->first, pending_write())).first;
+
+                if(m_pending.size() == 1 || m_pending.size() >= m_config.write_behind.batch) {
+                    m_wakeup.notify_one();
+                }
+            }
+
+            pending->second.value.swap(it->second);
+            pending->second.expire = expiration(table, it->first, expire);
+            pending->second.codec = codec;
+
+            m_write_stats.queued++;
+            cache_map.erase(it++);
+        }
+    }
+
+    void Client::flush_writes() {
+        boost::unique_lock<boost::mutex> lock(m_pending_mutex);
+
+        if(!m_writer) {
+            return;
+        }
+
+        // The writer runs until the queue is empty, then the last batch has to land
+        m_wakeup.notify_one();
+
+        while(!m_pending.empty() || !m_flushing.empty()) {
+            m_room.wait(lock);
+        }
+    }
+
+    counters_t Client::get_write_stats() {
+        boost::lock_guard<boost::mutex> lock(m_pending_mutex);
+
+        return boost::assign::map_list_of
+            ("queued", m_write_stats.queued)
+            ("coalesced", m_write_stats.coalesced)
+            ("dropped", m_write_stats.dropped)
+            ("flushed", m_write_stats.flushed)
+            ("pending", static_cast<uint64_t>(m_pending.size() + m_flushing.size()));
+    }
+
+    void Client::start_writer() {
+        m_stopping = false;
+        m_writer.reset(new boost::thread(&Client::write_behind, this));
+    }
+
+    void Client::stop_writer() {
+        if(!m_writer) {
+            return;
+        }
+
+        {
+            boost::lock_guard<boost::mutex> lock(m_pending_mutex);
+            m_stopping = true;
+        }
+
+        m_wakeup.notify_all();
+        m_room.notify_all();
+
+        m_writer->join();
+        m_writer.reset();
+    }
+
+    void Client::write_behind() {
+        boost::unique_lock<boost::mutex> lock(m_pending_mutex);
+
+        while(true) {
+            while(m_pending.empty() && !m_stopping) {
+                m_wakeup.wait(lock);
+            }
+
+            // Everything's been written out by now
+            if(m_pending.empty()) {
+                return;
+            }
+
+            // Giving the batch a chance to fill up
+            boost::system_time until = boost::get_system_time() +
+                boost::posix_time::milliseconds(m_config.write_behind.delay);
+
+            while(m_pending.size() < m_config.write_behind.batch && !m_stopping &&
+                m_wakeup.timed_wait(lock, until)) {}
+
+            // The batch stays visible to the readers until it's acknowledged
+            m_flushing.swap(m_pending);
+            m_room.notify_all();
+
+            lock.unlock();
+            write(m_flushing, true);
+            lock.lock();
+
+            m_write_stats.flushed += m_flushing.size();
+            m_flushing.clear();
+            m_room.notify_all();
+        }
+    }
+
+    void Client::write(const pending_map_t& writes, bool pipelined) {
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, true, &rc);
+        compressor<lzo> deflate;
+
+        if(!connection.valid()) {
+            return;
+        }
+
+        boost::shared_ptr<const policy_table> table = policies();
+        const char* data;
+        size_t length;
+        uint32_t flags;
+        string buffer;
+
+        // The last write to every server goes unbuffered: memcached handles the requests of
+        // a connection in order, so once it's acknowledged, the whole batch has landed there
+        map<uint32_t, const string*> barriers;
+
+        if(pipelined) {
+            for(pending_map_t::const_iterator it = writes.begin(); it != writes.end(); ++it) {
+                const string& wire = wire_key(it->first, buffer);
+                barriers[memcached_generate_hash(*connection, wire.data(), wire.length())] = &it->first;
+            }
+        }
+
+        uint64_t buffering = memcached_behavior_get(*connection, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS);
+
+        for(pending_map_t::const_iterator it = writes.begin(); it != writes.end(); ++it) {
+            const string& wire = wire_key(it->first, buffer);
+            bool barrier = !pipelined ||
+                barriers[memcached_generate_hash(*connection, wire.data(), wire.length())] == &it->first;
+
+            memcached_behavior_set(*connection, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS, !barrier);
+
+            trace_scope trace(m_tracer, trace_set, it->first);
+
+            const policy& rules = table->resolve(it->first);
+
+            flags = encode(deflate, it->second.value, rules.compression_threshold, data, length) |
+                (it->second.codec & flags::codec_mask);
+
+            rc = put(*connection, memcached_set, it->first, rules.replication_factor, data, length,
+                it->second.expire, flags);
+
+            trace.value_length = length;
+            trace.inflated_length = it->second.value.length();
+            trace.flags = traced_flags(flags);
+            trace.rc = rc;
+
+            if(rc != MEMCACHED_SUCCESS && rc != MEMCACHED_BUFFERED) {
+                report(__func__, *connection, rc, wire);
+            }
+        }
+
+        memcached_flush_buffers(*connection);
+        memcached_behavior_set(*connection, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS, buffering);
+    }
+
+    bool Client::read_pending(const string& key, fetch_fn_t fetch_fn) {
+        pending_write write;
+
+        {
+            boost::lock_guard<boost::mutex> lock(m_pending_mutex);
+            pending_map_t::const_iterator it = m_pending.find(key);
+
+            if(it == m_pending.end() && (it = m_flushing.find(key)) == m_flushing.end()) {
+                return false;
+            }
+
+            write = it->second;
+        }
+
+        fetch_fn(key, write.value.data(), write.value.length(), write.codec & flags::codec_mask, 0);
+        return true;
+    }
+
+    const cache_vector_t& Client::read_pending(const cache_vector_t& keys, fetch_fn_t fetch_fn,
+        cache_vector_t& remaining)
+    {
+        remaining.reserve(keys.size());
+
+        for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            if(it->empty() || !read_pending(*it, fetch_fn)) {
+                remaining.push_back(*it);
+            }
+        }
+
+        return remaining;
+    }
+
+    void Client::settle(const cache_vector_t& keys, bool discard) {
+        if(!m_writer) {
+            return;
+        }
+
+        pending_map_t writes;
+
+        {
+            boost::unique_lock<boost::mutex> lock(m_pending_mutex);
+
+            for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+                pending_map_t::iterator pending = m_pending.find(*it);
+
+                if(pending != m_pending.end()) {
+                    if(!discard) {
+                        writes.insert(*pending);
+                    }
+
+                    m_pending.erase(pending);
+                }
+            }
+
+            for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+                while(m_flushing.find(*it) != m_flushing.end()) {
+                    m_room.wait(lock);
+                }
+            }
+        }
+
+        m_room.notify_all();
+
+        if(!writes.empty()) {
+            write(writes, false);
+        }
+    }
+
+    bool Client::cas(const string& key, const string& value, uint64_t cas, time_t expire, uint32_t codec) {
+        if(key.empty() || value.empty()) {
+            return false;
+        }
+
+        cas_map_t cas_map = boost::assign::map_list_of(key, make_pair(value, cas));
+        cas_multi(cas_map, expire, codec);
+
+        return cas_map.empty();
+    }
+
+    void Client::cas_multi(cas_map_t& cas_map, time_t expire, uint32_t codec) {
+        if(m_writer) {
+            cache_vector_t keys;
+
+            keys.reserve(cas_map.size());
+
+            for(cas_map_t::const_iterator key = cas_map.begin(); key != cas_map.end(); ++key) {
+                keys.push_back(key->first);
+            }
+
+            settle(keys);
+        }
+
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+        compressor<lzo> deflate;
+
+        if(!connection.valid()) {
+            return;
+        }
+
+        boost::shared_ptr<const policy_table> table = policies();
+        cas_map_t::iterator it = cas_map.begin();
+        const char* data;
+        size_t length;
+        uint32_t flags;
+        string buffer;
+
+        while(it != cas_map.end()) {
+            if(it->first.empty() || it->second.first.empty()) {
+                ++it;
+                continue;
+            }
+
+            trace_call call = m_tracer.begin();
+            const policy& rules = table->resolve(it->first);
+
+            flags = encode(deflate, it->second.first, rules.compression_threshold, data, length) |
+                (codec & flags::codec_mask);
+
+            rc = put(*connection, cas_fn(it->second.second), it->first, rules.replication_factor, data, length,
+                rules.expiration(expire), flags);
+
+            if(call.id) {
+                m_tracer.record(call, trace_cas, it->first, length, it->second.first.length(), traced_flags(flags), rc);
+            }
+
+            if(rc == MEMCACHED_SUCCESS) {
+                cas_map.erase(it++);
+            } else {
+                // Losing the race is a normal outcome for an optimistic update
+                if(rc != MEMCACHED_DATA_EXISTS && rc != MEMCACHED_NOTFOUND) {
+                    report(__func__, *connection, rc, wire_key(it->first, buffer));
+                }
+                ++it;
+            }
+        }
+    }
+
+    bool Client::arithmetic(arithmetic_fn_t arithmetic_fn, const string& key, uint64_t delta, uint64_t& value) {
+        if(key.empty()) {
+            return false;
+        }
+
+        settle(key);
+
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+
+        if(!connection.valid()) {
+            return false;
+        }
+
+        trace_scope trace(m_tracer, arithmetic_fn == memcached_increment ? trace_incr : trace_decr, key);
+        string buffer;
+        const string& wire = wire_key(key, buffer);
+
+        // The plain commands only take 32-bit deltas. The binary protocol takes the full 64 bits
+        // with the commands creating the missing counters, when told never to create them
+        bool wide = delta > numeric_limits<uint32_t>::max();
+
+        if(wide && !memcached_behavior_get(*connection, MEMCACHED_BEHAVIOR_BINARY_PROTOCOL)) {
+            LOG4CXX_ERROR(m_log, boost::format("%1%: the delta of %2% needs the binary protocol") % __func__ % delta);
+            trace.rc = MEMCACHED_INVALID_ARGUMENTS;
+            return false;
+        }
+
+        if(!reachable(*connection, wire)) {
+            rc = MEMCACHED_SERVER_MARKED_DEAD;
+        } else if(wide) {
+            rc = (arithmetic_fn == memcached_increment ? memcached_increment_with_initial : memcached_decrement_with_initial)
+                (*connection, wire.data(), wire.length(), delta, 0, MEMCACHED_EXPIRATION_NOT_ADD, &value);
+        } else {
+            rc = arithmetic_fn(*connection, wire.data(), wire.length(), delta, &value);
+        }
+
+        trace.rc = rc;
+
+        // Counters aren't replicated, as the copies would never agree, and a failed
+        // update might still have been applied
+        if(rc != MEMCACHED_NOTFOUND) {
+            replicate(*connection, wire, replication(*policies(), key), replica_delete());
+        }
+
+        if(rc != MEMCACHED_SUCCESS) {
+            if(rc != MEMCACHED_NOTFOUND) {
+                report(__func__, *connection, rc, wire);
+            }
+            return false;
+        }
+
+        return true;
+    }
+
+    bool Client::arithmetic(arithmetic_initial_fn_t arithmetic_fn, const string& key, uint64_t delta,
+        uint64_t initial, uint64_t& value, time_t expire)
+    {
+        if(key.empty()) {
+            return false;
+        }
+
+        settle(key);
+
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+
+        if(!connection.valid()) {
+            return false;
+        }
+
+        trace_scope trace(m_tracer, arithmetic_fn == memcached_increment_with_initial ? trace_incr : trace_decr, key);
+        string buffer;
+        const string& wire = wire_key(key, buffer);
+
+        boost::shared_ptr<const policy_table> table = policies();
+        const policy& rules = table->resolve(key);
+
+        rc = trace.rc = !reachable(*connection, wire) ? MEMCACHED_SERVER_MARKED_DEAD :
+            arithmetic_fn(*connection, wire.data(), wire.length(), delta, initial, rules.expiration(expire), &value);
+
+        if(rc != MEMCACHED_NOTFOUND) {
+            replicate(*connection, wire, rules.replication_factor, replica_delete());
+        }
+
+        if(rc != MEMCACHED_SUCCESS) {
+            report(__func__, *connection, rc, wire);
+            return false;
+        }
+
+        return true;
+    }
+
+    void Client::replicas(const memcached_st* connection, const string& key, uint32_t factor,
+        vector<uint32_t>& result) const
+    {
+        uint32_t count = m_subnets.size();
+
+        factor = std::min<uint32_t>(factor, count);
+
+        result.clear();
+
+        if(!count) {
+            return;
+        }
+
+        result.push_back(memcached_generate_hash(connection, key.data(), key.length()));
+
+        // Successors on the other subnets go first, then the rest of them
+        for(int pass = 0; pass < 2 && result.size() < factor; ++pass) {
+            for(uint32_t i = 1; i < count && result.size() < factor; ++i) {
+                uint32_t server = (result.front() + i) % count;
+                bool suitable = std::find(result.begin(), result.end(), server) == result.end();
+
+                for(vector<uint32_t>::const_iterator it = result.begin(); pass == 0 && suitable && it != result.end(); ++it) {
+                    suitable = m_subnets[*it] != m_subnets[server];
+                }
+
+                if(suitable) {
+                    result.push_back(server);
+                }
+            }
+        }
+    }
+
+    bool Client::routing_key(const cache_vector_t& routes, uint32_t server, string& result) {
+        if(server >= routes.size() || routes[server].empty()) {
+            return false;
+        }
+
+        result = routes[server];
+        return true;
+    }
+
+    void Client::route(const memcached_st* connection) {
+        uint32_t count = memcached_server_count(connection), found = 0;
+        boost::shared_ptr<cache_vector_t> routes = boost::make_shared<cache_vector_t>(count);
+
+        // Servers with tiny weights take a while to come up with consistent hashing
+        for(uint32_t attempt = 0; found < count && attempt < count * 1024; ++attempt) {
+            key_builder candidate;
+
+            candidate << "route#" << attempt;
+
+            uint32_t server = memcached_generate_hash(connection, candidate.data(), candidate.length());
+
+            if(server < count && (*routes)[server].empty()) {
+                (*routes)[server].assign(candidate.data(), candidate.length());
+                found++;
+            }
+        }
+
+        if(found < count) {
+            LOG4CXX_WARN(m_log, boost::format("no routing keys for %1% of %2% servers, their copies are skipped") %
+                (count - found) % count);
+        }
+
+        boost::atomic_store(&m_routes, boost::shared_ptr<const cache_vector_t>(routes));
+    }
+
+    template<typename ReplicaFn>
+    void Client::replicate(memcached_st* connection, const string& key, uint32_t factor, ReplicaFn replica_fn) {
+        if(factor < 2) {
+            return;
+        }
+
+        vector<uint32_t> servers;
+        string route;
+
+        replicas(connection, key, factor, servers);
+
+        if(servers.size() < 2) {
+            return;
+        }
+
+        boost::shared_ptr<const cache_vector_t> routing = routes();
+
+        // The copies are written in one pipelined batch, without waiting for the replies
+        uint64_t buffering = memcached_behavior_get(connection, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS);
+        memcached_behavior_set(connection, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS, 1);
+
+        for(vector<uint32_t>::const_iterator it = servers.begin() + 1; it != servers.end(); ++it) {
+            if(routing_key(*routing, *it, route)) {
+                replica_fn(connection, route.data(), route.length(), key.data(), key.length());
+            }
+        }
+
+        memcached_flush_buffers(connection);
+        memcached_behavior_set(connection, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS, buffering);
+    }
+
+    template<typename ReadFn>
+    memcached_return_t Client::read_replicas(memcached_st* connection, const string& key, const string& wire,
+        memcached_return_t rc, deadline& limit, ReadFn read_fn)
+    {
+        vector<uint32_t> servers;
+        string route;
+
+        boost::shared_ptr<const cache_vector_t> routing = routes();
+
+        replicas(connection, wire, replication(*policies(), key), servers);
+
+        for(size_t i = 1; i < servers.size() && rc != MEMCACHED_SUCCESS && rc != MEMCACHED_NOTFOUND; ++i) {
+            if(!limit.arm()) {
+                break;
+            }
+
+            if(routing_key(*routing, servers[i], route)) {
+                rc = read_fn(connection, route);
+                limit.check(rc);
+            }
+        }
+
+        return rc;
+    }
+
+    const string& Client::wire_key(const string& key, string& buffer) const {
+        if(!m_config.keys.hashing || is_legal_key(key.data(), key.length())) {
+            return key;
+        }
+
+        digest_key(key.data(), key.length(), buffer);
+        return buffer;
+    }
+
+    bool Client::touch(const string& key, time_t expire) {
+        if(key.empty()) {
+            return false;
+        }
+
+        cache_vector_t cache_vector = boost::assign::list_of(key);
+        touch_multi(cache_vector, expire);
+
+        return cache_vector.empty();
+    }
+
+    void Client::touch_multi(cache_vector_t& cache_vector, time_t expire) {
+        touch_multi(cache_vector, expire, false);
+    }
+
+    void Client::touch_multi(cache_vector_t& cache_vector, time_t expire, bool exact) {
+        settle(cache_vector);
+
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+
+        if(!connection.valid()) {
+            return;
+        }
+
+        boost::shared_ptr<const policy_table> table = policies();
+        cache_vector_t::iterator it = cache_vector.begin();
+        map<string, helpers::manifest> manifests;
+        string buffer, chunk_key;
+
+        // The chunks have to live as long as their manifests, which are only told from
+        // the plain values by fetching them. It takes a multi-get of the keys, so it's
+        // only done with chunking enabled
+        if(m_config.chunking.size) {
+            cache_vector_t wires;
+
+            for(cache_vector_t::const_iterator key = cache_vector.begin(); key != cache_vector.end(); ++key) {
+                if(!key->empty()) {
+                    wires.push_back(wire_key(*key, buffer));
+                }
+            }
+
+            fetch_manifests(*connection, wires, manifests);
+        }
+
+        while(it != cache_vector.end()) {
+            if(it->empty()) {
+                ++it;
+                continue;
+            }
+
+            trace_call call = m_tracer.begin();
+            const string& wire = wire_key(*it, buffer);
+            time_t expiry = exact ? expire : expiration(*table, *it, expire);
+
+            rc = !reachable(*connection, wire) ? MEMCACHED_SERVER_MARKED_DEAD :
+                memcached_touch(*connection, wire.data(), wire.length(), expiry);
+
+            if(call.id) {
+                m_tracer.record(call, trace_touch, *it, 0, 0, 0, rc);
+            }
+
+            if(rc == MEMCACHED_SUCCESS) {
+                map<string, helpers::manifest>::const_iterator manifest = manifests.find(wire);
+
+                for(uint32_t chunk = 0; manifest != manifests.end() && chunk < manifest->second.count(); ++chunk) {
+                    manifest->second.key(*it, chunk, chunk_key);
+                    memcached_touch(*connection, chunk_key.data(), chunk_key.length(), expiry);
+                }
+
+                replicate(*connection, wire, replication(*table, *it), replica_touch(expiry));
+                it = cache_vector.erase(it);
+            } else {
+                if(rc != MEMCACHED_NOTFOUND) {
+                    report(__func__, *connection, rc, wire);
+                }
+                ++it;
+            }
+        }
+    }
+
+    string Client::get_and_touch(const string& key, time_t expire) {
+        string result;
+        get_and_touch(key, expire, string_collector(result));
+        return result;
+    }
+
+    void Client::get_and_touch(const string& key, time_t expire, fetch_fn_t fetch_fn) {
+        if(key.empty()) {
+            return;
+        }
+
+        // The item is touched first: that's a header-sized round trip, and a miss
+        // saves us the get altogether
+        cache_vector_t cache_vector = boost::assign::list_of(key);
+        touch_multi(cache_vector, expire, true);
+
+        if(cache_vector.empty()) {
+            get(key, fetch_fn);
+        }
+    }
+
+    bool Client::remove(const string& key) {
+        if(key.empty()) {
+            return false;
+        }
+        
+        cache_vector_t cache_vector = boost::assign::list_of(key);
+        remove_multi(cache_vector);
+    
+        return cache_vector.empty();
+    }
+
+    void Client::remove_multi(cache_vector_t& cache_vector) {
+        // The pending writes would bring the items back
+        settle(cache_vector, true);
+
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+
+        if(!connection.valid()) {
+            return;
+        }
+
+        boost::shared_ptr<const policy_table> table = policies();
+        cache_vector_t::iterator it = cache_vector.begin();
+        string buffer;
+
+        while(it != cache_vector.end()) {
+            if(it->empty()) {
+                ++it;
+                continue;
+            }
+
+            trace_call call = m_tracer.begin();
+            const string& wire = wire_key(*it, buffer);
+
+            rc = !reachable(*connection, wire) ? MEMCACHED_SERVER_MARKED_DEAD :
+                memcached_delete(*connection, wire.data(), wire.length(), static_cast<time_t>(0));
+
+            if(call.id) {
+                m_tracer.record(call, trace_remove, *it, 0, 0, 0, rc);
+            }
+
+            // Even when the primary server is down, so that the copies can't outlive the item
+            replicate(*connection, wire, replication(*table, *it), replica_delete());
+            
+            if(rc == MEMCACHED_SUCCESS || rc == MEMCACHED_NOTFOUND) {
+                it = cache_vector.erase(it);
+            } else {
+                report(__func__, *connection, rc, wire);
+                ++it;
+            }
+        }
+    }
+
+    void Client::flush() {
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+
+        if(!connection.valid()) {
+            return;
+        }
+
+        rc = memcached_flush(*connection, static_cast<time_t>(0));
+
+        if(rc != MEMCACHED_SUCCESS) {
+            report(__func__, *connection, rc);
+        }
+    }
+
+    namespace {
+        static memcached_return_t collector(
+                memcached_server_instance_st instance,
+                const char* key, size_t key_length,
+                const char* value, size_t value_length,
+                void* context)
+        {
+            boost::format name = boost::format("%1%:%2%") %
+                memcached_server_name(instance) %
+                memcached_server_port(instance);
+
+            stats_t* stats = reinterpret_cast<stats_t*>(context);
+            cache_map_t& counters = (*stats)[name.str()];
+            
+            counters.insert(std::make_pair(
+                std::string(key, key_length),
+                std::string(value, value_length)));
+
+            return MEMCACHED_SUCCESS;
+        }
+    }
+
+    stats_t Client::get_stats() {
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+        stats_t result;
+    
+        if(!connection.valid()) {
+            return result;
+        }
+
+        memcached_stat_execute(*connection, NULL, collector, &result);
+
+        return result;
+    }
+
+    void Client::locate(const cache_vector_t& keys, vector<uint32_t>& result) {
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+        string buffer;
+
+        result.clear();
+
+        if(!connection.valid()) {
+            return;
+        }
+
+        result.reserve(keys.size());
+
+        for(cache_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            const string& wire = wire_key(*it, buffer);
+            result.push_back(memcached_generate_hash(*connection, wire.data(), wire.length()));
+        }
+    }
+
+    vector<string> Client::get_servers() const {
+        memcached_return_t rc;
+        pooled_connection connection(m_pool, m_config.pool.blocking, &rc);
+        vector<string> result;
+
+        if(!connection.valid()) {
+            return result;
+        }
+
+        for(uint32_t i = 0; i < memcached_server_count(*connection); ++i) {
+            memcached_server_instance_st instance = memcached_server_instance_by_position(*connection, i);
+
+            result.push_back((boost::format("%1%:%2%") %
+                memcached_server_name(instance) %
+                memcached_server_port(instance)).str());
+        }
+
+        return result;
+    }
+
+    cluster_stats_ptr Client::get_cluster_stats() const {
+        return m_stats.snapshot();
+    }
+
+    void Client::start_sampler() {
+        m_sampler.reset(new boost::thread(&Client::sample_stats, this));
+    }
+
+    void Client::stop_sampler() {
+        if(!m_sampler) {
+            return;
+        }
+
+        m_sampler->interrupt();
+        m_sampler->join();
+        m_sampler.reset();
+    }
+
+    void Client::sample_stats() {
+        memcached_return_t rc;
+
+        try {
+            while(true) {
+                {
+                    // Waiting for a connection here rather than in the request path
+                    pooled_connection connection(m_pool, true, &rc);
+
+                    if(connection.valid()) {
+                        m_stats.sample(*connection);
+                    }
+                }
+
+                boost::this_thread::sleep(boost::posix_time::seconds(m_config.stats.interval));
+            }
+        } catch(const boost::thread_interrupted&) {
+            // Stopped by stop_sampler()
+        }
+    }
+
+    void Client::start_prober() {
+        m_prober.reset(new boost::thread(&Client::probe_servers, this));
+    }
+
+    void Client::stop_prober() {
+        if(!m_prober) {
+            return;
+        }
+
+        m_prober->interrupt();
+        m_prober->join();
+        m_prober.reset();
+    }
+
+    void Client::probe_servers() {
+        try {
+            while(true) {
+                m_health.probe(m_config.health.timeout, m_config.health.failures);
+                boost::this_thread::sleep(boost::posix_time::milliseconds(m_config.health.interval));
+            }
+        } catch(const boost::thread_interrupted&) {
+            // Stopped by stop_prober()
+        }
+    }
+
+    void Client::on_health_change(health_fn_t health_fn) {
+        m_health.subscribe(health_fn);
+    }
+
+    map<string, bool> Client::get_health() const {
+        return m_health.snapshot();
+    }
+
+    counters_t Client::get_health_stats() const {
+        return m_health.counters();
+    }
+
+    bool Client::save_hot_keys(const string& path) const {
+        if(!m_config.hot_keys.capacity) {
+            return false;
+        }
+
+        if(!m_hot_keys.save(path)) {
+            LOG4CXX_WARN(m_log, boost::format("failed to save the hot keys to %1%") % path);
+            return false;
+        }
+
+        return true;
+    }
+
+    void Client::snapshot_hot_keys(const string& path, uint32_t interval) {
+        stop_snapshots();
+
+        m_snapshot_path = path;
+
+        if(interval) {
+            m_snapshots.reset(new boost::thread(&Client::save_snapshots, this, interval));
+        }
+    }
+
+    void Client::stop_snapshots() {
+        if(m_snapshots) {
+            m_snapshots->interrupt();
+            m_snapshots->join();
+            m_snapshots.reset();
+        }
+
+        if(!m_snapshot_path.empty()) {
+            save_hot_keys(m_snapshot_path);
+        }
+    }
+
+    void Client::save_snapshots(uint32_t interval) {
+        try {
+            while(true) {
+                boost::this_thread::sleep(boost::posix_time::seconds(interval));
+                save_hot_keys(m_snapshot_path);
+            }
+        } catch(const boost::thread_interrupted&) {
+            // Stopped by stop_snapshots()
+        }
+    }
+
+    namespace {
+        struct counting_fetch {
+            counting_fetch(fetch_fn_t fetch_fn_, size_t& count_):
+                fetch_fn(fetch_fn_),
+                count(count_) {}
+
+            void operator()(const string& key, const char* value, size_t value_length, uint32_t codec, uint64_t cas) {
+                count++;
+                fetch_fn(key, value, value_length, codec, cas);
+            }
+
+            fetch_fn_t fetch_fn;
+            size_t& count;
+        };
+    }
+
+    size_t Client::warm(const string& path, fetch_fn_t fetch_fn, uint32_t chunk) {
+        cache_vector_t keys, batch;
+        size_t found = 0;
+
+        if(!hot_keys::load(path, keys)) {
+            LOG4CXX_WARN(m_log, boost::format("no hot keys to warm up with in %1%") % path);
+            return 0;
+        }
+
+        LOG4CXX_INFO(m_log, boost::format("warming up with %1% hot keys") % keys.size());
+
+        chunk = std::max<uint32_t>(chunk, 1);
+
+        for(size_t offset = 0; offset < keys.size(); offset += chunk) {
+            batch.assign(keys.begin() + offset, keys.begin() + std::min<size_t>(offset + chunk, keys.size()));
+            fetch(batch, counting_fetch(fetch_fn, found));
+        }
+
+        return found;
+    }
+
+    namespace {
+        // Version counters have to outlive the items in their namespaces, so
+        // they're stored for the longest relative expiration memcached allows
+        const time_t namespace_expiration = 30 * 24 * 60 * 60;
+
+        // Versions which couldn't be looked up are made up, and only kept for this long
+        const time_t unsettled_namespace_ttl = 1;
+
+        inline string version_key(const string& ns) {
+            return ns + ":ns-version";
+        }
+    }
+
+    string Client::namespaced_key(const string& ns, const string& key) {
+        versions_t versions = namespace_versions(boost::assign::list_of(ns));
+        key_builder result;
+
+        result << ns << ":v" << versions[ns] << ':' << key;
+        return result.str();
+    }
+
+    cache_vector_t Client::namespaced_keys(const namespaced_vector_t& keys) {
+        cache_vector_t namespaces, result;
+
+        namespaces.reserve(keys.size());
+        result.reserve(keys.size());
+
+        for(namespaced_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            namespaces.push_back(it->first);
+        }
+
+        versions_t versions = namespace_versions(namespaces);
+
+        for(namespaced_vector_t::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            key_builder key;
+
+            key << it->first << ":v" << versions[it->first] << ':' << it->second;
+            result.push_back(key.str());
+        }
+
+        return result;
+    }
+
+    versions_t Client::namespace_versions(const cache_vector_t& namespaces) {
+        versions_t result;
+        cache_vector_t missing, looked_up;
+        std::set<string> unsettled;
+        time_t now = time(NULL);
+
+        {
+            boost::mutex::scoped_lock lock(m_namespaces_mutex);
+
+            for(cache_vector_t::const_iterator it = namespaces.begin(); it != namespaces.end(); ++it) {
+                namespace_cache_t::const_iterator cached = m_namespaces.find(*it);
+
+                if(cached != m_namespaces.end() && cached->second.second > now) {
+                    result[*it] = cached->second.first;
+                } else if(result.insert(make_pair(*it, 0)).second) {
+                    missing.push_back(version_key(*it));
+                    looked_up.push_back(*it);
+                }
+            }
+        }
+
+        if(missing.empty()) {
+            return result;
+        }
+
+        // All the expired versions are fetched in one go
+        cache_map_t versions = get_multi(missing);
+
+        for(versions_t::iterator it = result.begin(); it != result.end(); ++it) {
+            if(it->second) {
+                continue;
+            }
+
+            cache_map_t::const_iterator version = versions.find(version_key(it->first));
+
+            if(version != versions.end()) {
+                it->second = strtoull(version->second.c_str(), NULL, 10);
+            }
+
+            if(!it->second) {
+                // Starting from the current time, so that a namespace with an evicted
+                // counter never gets back to the versions it has already been through
+                string initial = boost::lexical_cast<string>(now);
+
+                if(add(version_key(it->first), initial, namespace_expiration)) {
+                    it->second = now;
+                } else {
+                    // Someone has beaten us to it
+                    it->second = strtoull(get(version_key(it->first)).c_str(), NULL, 10);
+                }
+            }
+
+            // The servers are failing, so the keys are composed with a random version, which
+            // is never a real one, as those start from the current time: they're misses rather
+            // than the keys of whatever has been stored under the zero version before
+            if(!it->second) {
+                LOG4CXX_WARN(m_log, boost::format("failed to look up the version of namespace %1%") % it->first);
+                unsettled.insert(it->first);
+                it->second = generation() | (1ULL << 63);
+            }
+        }
+
+        {
+            boost::mutex::scoped_lock lock(m_namespaces_mutex);
+
+            for(cache_vector_t::const_iterator it = looked_up.begin(); it != looked_up.end(); ++it) {
+                m_namespaces[*it] = make_pair(result[*it], now +
+                    (unsettled.count(*it) ? unsettled_namespace_ttl : m_config.namespaces.ttl));
+            }
+        }
+
+        return result;
+    }
+
+    bool Client::invalidate_namespace(const string& ns) {
+        uint64_t version;
+
+        if(!incr(version_key(ns), 1, version)) {
+            // The counter is gone, so it's reinitialized past every version it could've had,
+            // leaving out the made up ones
+            version = time(NULL);
+
+            {
+                boost::mutex::scoped_lock lock(m_namespaces_mutex);
+                namespace_cache_t::const_iterator cached = m_namespaces.find(ns);
+
+                if(cached != m_namespaces.end() && !(cached->second.first >> 63) &&
+                    cached->second.first >= static_cast<uint64_t>(version))
+                {
+                    version = cached->second.first + 1;
+                }
+            }
+
+            if(!set(version_key(ns), boost::lexical_cast<string>(version), namespace_expiration)) {
+                return false;
+            }
+        }
+
+        // This process sees the new version right away, and the others within the TTL
+        boost::mutex::scoped_lock lock(m_namespaces_mutex);
+        m_namespaces[ns] = make_pair(version, time(NULL) + m_config.namespaces.ttl);
+
+        return true;
+    }
+
+    void Client::report(const char* function, const memcached_st* connection, memcached_return_t code, const string& key) {
+        uint32_t server = m_errors.unknown();
+        time_t since = 0;
+
+        // Without a key, it's the server libmemcached has given up on last
+        if(code == MEMCACHED_SERVER_MARKED_DEAD && key.empty()) {
+            memcached_server_instance_st instance = memcached_server_get_last_disconnect(connection);
+
+            if(instance) {
+                server = m_errors.find(instance);
+            }
+        } else if(!key.empty()) {
+            server = memcached_generate_hash(connection, key.data(), key.length());
+        }
+
+        uint64_t failures = m_errors.account(server, code, since);
+
+        // The bursts on the other servers which have ended in the meantime
+        report_pending(false);
+
+        // Somebody else has reported recently
+        if(!failures) {
+            return;
+        }
+
+        if(since) {
+            LOG4CXX_ERROR(m_log, boost::format("%1% failures on %2% in the last %3%s, the latest: %4% failed for key '%5%': %6%") %
+                failures %
+                m_errors.name(server) %
+                (time(NULL) - since) %
+                function %
+                key %
+                memcached_strerror(const_cast<memcached_st*>(connection), code));
         } else {
-            return boost::format("%1% failed: %2%") %
+            LOG4CXX_ERROR(m_log, boost::format("%1% failed for key '%2%' on %3%: %4%") %
                 function %
-                memcached_strerror(const_cast<memcached_st*>(connection), code);
+                key %
+                m_errors.name(server) %
+                memcached_strerror(const_cast<memcached_st*>(connection), code));
+        }
+    }
+
+    void Client::report_pending(bool force) {
+        pending_errors_t pending = m_errors.pending(force);
+        time_t now = time(NULL);
+
+        for(pending_errors_t::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+            LOG4CXX_ERROR(m_log, boost::format("%1% failures on %2% in the last %3%s") %
+                it->second.first %
+                it->first %
+                (now - it->second.second));
         }
     }
+
+    errors_t Client::get_errors() const {
+        return m_errors.snapshot();
+    }
 }}
 
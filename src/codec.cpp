@@ -0,0 +1,308 @@
+#include "codec.hpp"
+#include "cache.hpp"
+
+#include <climits>
+#include <cstring>
+
+namespace yandex { namespace memcached { namespace python {
+    namespace {
+        // Deeper structures are left to pickle, which handles recursion properly
+        const int max_depth = 32;
+
+        template<typename T>
+        inline void put(std::string& result, T value) {
+            result.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        template<typename T>
+        inline bool get(const char*& data, const char* end, T& value) {
+            if(static_cast<size_t>(end - data) < sizeof(value)) {
+                return false;
+            }
+
+            memcpy(&value, data, sizeof(value));
+            data += sizeof(value);
+
+            return true;
+        }
+
+        inline bool put_string(std::string& result, char tag, const char* data, Py_ssize_t length) {
+            if(static_cast<uint64_t>(length) > std::numeric_limits<uint32_t>::max()) {
+                return false;
+            }
+
+            result += tag;
+            put<uint32_t>(result, length);
+            result.append(data, length);
+
+            return true;
+        }
+    }
+
+    Codec::Codec() {
+        object pickle;
+
+        try {
+            pickle = import("cPickle");
+        } catch(const error_already_set&) {
+            PyErr_Clear();
+            pickle = import("pickle");
+        }
+
+        m_dumps = pickle.attr("dumps");
+        m_loads = pickle.attr("loads");
+    }
+
+    uint32_t Codec::encode(const object& value, std::string& result) const {
+        result.clear();
+
+        // Strings go as they are, so that they are still readable by other clients
+        if(PyString_CheckExact(value.ptr())) {
+            result.assign(PyString_AS_STRING(value.ptr()), PyString_GET_SIZE(value.ptr()));
+            return 0;
+        }
+
+        if(PyInt_CheckExact(value.ptr()) || PyLong_CheckExact(value.ptr())) {
+            result = extract<std::string>(str(value));
+            return codecs::integer;
+        }
+
+        if(pack(value.ptr(), result, 0)) {
+            return codecs::native;
+        }
+
+        // Highest protocol available
+        result = extract<std::string>(m_dumps(value, -1));
+        return codecs::pickled;
+    }
+
+    object Codec::decode(const char* data, size_t length, uint32_t flags) const {
+        switch(flags & flags::codec_mask) {
+            case codecs::native: {
+                const char* end = data + length;
+                PyObject* result = unpack(data, end, 0);
+
+                if(!result || data != end) {
+                    Py_XDECREF(result);
+                    PyErr_Clear();
+                    return object();
+                }
+
+                return object(handle<>(result));
+            }
+
+            case codecs::integer: {
+                // The servers pad the values shortened by decr with spaces, which are skipped
+                std::string text(data, length);
+                PyObject* result = PyInt_FromString(const_cast<char*>(text.c_str()), NULL, 10);
+
+                if(!result) {
+                    PyErr_Clear();
+                    return object();
+                }
+
+                return object(handle<>(result));
+            }
+
+            case codecs::pickled:
+                try {
+                    return m_loads(str(data, length));
+                } catch(const error_already_set&) {
+                    // Stale classes and such are treated as misses
+                    PyErr_Clear();
+                    return object();
+                }
+
+            default:
+                return str(data, length);
+        }
+    }
+
+    bool Codec::pack(PyObject* value, std::string& result, int depth) const {
+        if(depth > max_depth) {
+            return false;
+        }
+
+        if(value == Py_None) {
+            result += 'N';
+        } else if(PyBool_Check(value)) {
+            result += (value == Py_True) ? 'T' : 'F';
+        } else if(PyInt_CheckExact(value)) {
+            result += 'i';
+            put<int64_t>(result, PyInt_AS_LONG(value));
+        } else if(PyLong_CheckExact(value)) {
+            PY_LONG_LONG number = PyLong_AsLongLong(value);
+
+            // Too long for us
+            if(number == -1 && PyErr_Occurred()) {
+                PyErr_Clear();
+                return false;
+            }
+
+            result += 'I';
+            put<int64_t>(result, number);
+        } else if(PyFloat_CheckExact(value)) {
+            result += 'f';
+            put<double>(result, PyFloat_AS_DOUBLE(value));
+        } else if(PyString_CheckExact(value)) {
+            return put_string(result, 's', PyString_AS_STRING(value), PyString_GET_SIZE(value));
+        } else if(PyUnicode_CheckExact(value)) {
+            handle<> utf8(allow_null(PyUnicode_AsUTF8String(value)));
+
+            if(!utf8) {
+                PyErr_Clear();
+                return false;
+            }
+
+            return put_string(result, 'u', PyString_AS_STRING(utf8.get()), PyString_GET_SIZE(utf8.get()));
+        } else if(PyList_CheckExact(value)) {
+            result += 'l';
+            put<uint32_t>(result, PyList_GET_SIZE(value));
+
+            for(Py_ssize_t i = 0; i < PyList_GET_SIZE(value); ++i) {
+                if(!pack(PyList_GET_ITEM(value, i), result, depth + 1)) {
+                    return false;
+                }
+            }
+        } else if(PyTuple_CheckExact(value)) {
+            result += 't';
+            put<uint32_t>(result, PyTuple_GET_SIZE(value));
+
+            for(Py_ssize_t i = 0; i < PyTuple_GET_SIZE(value); ++i) {
+                if(!pack(PyTuple_GET_ITEM(value, i), result, depth + 1)) {
+                    return false;
+                }
+            }
+        } else if(PyDict_CheckExact(value)) {
+            PyObject *k, *v;
+            Py_ssize_t position = 0;
+
+            result += 'd';
+            put<uint32_t>(result, PyDict_Size(value));
+
+            while(PyDict_Next(value, &position, &k, &v)) {
+                if(!pack(k, result, depth + 1) || !pack(v, result, depth + 1)) {
+                    return false;
+                }
+            }
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+    PyObject* Codec::unpack(const char*& data, const char* end, int depth) const {
+        uint32_t length;
+        int64_t number;
+        double real;
+        PyObject* result;
+        char tag;
+
+        if(depth > max_depth || data == end) {
+            return NULL;
+        }
+
+        tag = *data++;
+
+        switch(tag) {
+            case 'N':
+                Py_RETURN_NONE;
+
+            case 'T':
+                Py_RETURN_TRUE;
+
+            case 'F':
+                Py_RETURN_FALSE;
+
+            case 'i':
+                if(!get(data, end, number)) {
+                    return NULL;
+                }
+
+                if(number >= LONG_MIN && number <= LONG_MAX) {
+                    return PyInt_FromLong(static_cast<long>(number));
+                }
+
+                return PyLong_FromLongLong(number);
+
+            case 'I':
+                if(!get(data, end, number)) {
+                    return NULL;
+                }
+
+                return PyLong_FromLongLong(number);
+
+            case 'f':
+                if(!get(data, end, real)) {
+                    return NULL;
+                }
+
+                return PyFloat_FromDouble(real);
+
+            case 's':
+            case 'u':
+                if(!get(data, end, length) || static_cast<size_t>(end - data) < length) {
+                    return NULL;
+                }
+
+                result = (tag == 's') ?
+                    PyString_FromStringAndSize(data, length) :
+                    PyUnicode_DecodeUTF8(data, length, "strict");
+
+                data += length;
+                return result;
+
+            case 'l':
+            case 't': {
+                bool tuple = (tag == 't');
+
+                // Every item takes at least a byte, so this keeps us from
+                // allocating huge containers for broken data
+                if(!get(data, end, length) || static_cast<size_t>(end - data) < length) {
+                    return NULL;
+                }
+
+                result = tuple ? PyTuple_New(length) : PyList_New(length);
+
+                for(uint32_t i = 0; result && i < length; ++i) {
+                    PyObject* item = unpack(data, end, depth + 1);
+
+                    if(!item) {
+                        Py_CLEAR(result);
+                    } else if(tuple) {
+                        PyTuple_SET_ITEM(result, i, item);
+                    } else {
+                        PyList_SET_ITEM(result, i, item);
+                    }
+                }
+
+                return result;
+            }
+
+            case 'd':
+                if(!get(data, end, length) || static_cast<size_t>(end - data) < length * 2ULL) {
+                    return NULL;
+                }
+
+                result = PyDict_New();
+
+                for(uint32_t i = 0; result && i < length; ++i) {
+                    PyObject* k = unpack(data, end, depth + 1);
+                    PyObject* v = k ? unpack(data, end, depth + 1) : NULL;
+
+                    if(!v || PyDict_SetItem(result, k, v) != 0) {
+                        Py_CLEAR(result);
+                    }
+
+                    Py_XDECREF(k);
+                    Py_XDECREF(v);
+                }
+
+                return result;
+
+            default:
+                return NULL;
+        }
+    }
+}}}
@@ -0,0 +1,118 @@
+#include "errors.hpp"
+
+#include <cstring>
+
+#include <boost/format.hpp>
+
+namespace yandex { namespace memcached {
+    using namespace std;
+
+    error_counters::error_counters():
+        m_rows(new row[1]),
+        m_count(0)
+    {
+        memset(const_cast<uint64_t*>(m_rows[0].codes), 0, sizeof(m_rows[0].codes));
+        m_rows[0].name = "unknown";
+        m_rows[0].total = m_rows[0].reported = 0;
+        m_rows[0].logged = 0;
+    }
+
+    void error_counters::reset(const memcached_st* memcached) {
+        m_count = memcached ? memcached_server_count(memcached) : 0;
+        m_rows.reset(new row[m_count + 1]);
+
+        for(uint32_t i = 0; i <= m_count; ++i) {
+            memset(const_cast<uint64_t*>(m_rows[i].codes), 0, sizeof(m_rows[i].codes));
+            m_rows[i].total = m_rows[i].reported = 0;
+            m_rows[i].logged = 0;
+
+            if(i < m_count) {
+                memcached_server_instance_st instance = memcached_server_instance_by_position(memcached, i);
+
+                m_rows[i].name = (boost::format("%1%:%2%") %
+                    memcached_server_name(instance) %
+                    memcached_server_port(instance)).str();
+            } else {
+                m_rows[i].name = "unknown";
+            }
+        }
+    }
+
+    uint64_t error_counters::account(uint32_t server, memcached_return_t code, time_t& since) {
+        row& r = m_rows[server < m_count ? server : m_count];
+
+        if(code < MEMCACHED_MAXIMUM_RETURN) {
+            __sync_fetch_and_add(&r.codes[code], 1);
+        }
+
+        uint64_t total = __sync_add_and_fetch(&r.total, 1);
+        time_t now = time(NULL), logged = r.logged;
+
+        // Whoever manages to move the timestamp reports everything since the last time
+        if(now == logged || !__sync_bool_compare_and_swap(&r.logged, logged, now)) {
+            return 0;
+        }
+
+        since = logged;
+
+        uint64_t reported = __sync_lock_test_and_set(&r.reported, total);
+        return total > reported ? total - reported : 0;
+    }
+
+    pending_errors_t error_counters::pending(bool force) {
+        pending_errors_t result;
+        time_t now = time(NULL);
+
+        for(uint32_t i = 0; i <= m_count; ++i) {
+            row& r = m_rows[i];
+            time_t logged = r.logged;
+
+            if(r.total == r.reported) {
+                continue;
+            }
+
+            // Same as accounting a failure, but without one
+            if(!force && (now == logged || !__sync_bool_compare_and_swap(&r.logged, logged, now))) {
+                continue;
+            }
+
+            uint64_t total = r.total, reported = __sync_lock_test_and_set(&r.reported, total);
+
+            if(total > reported) {
+                result[r.name] = make_pair(total - reported, logged);
+            }
+        }
+
+        return result;
+    }
+
+    uint32_t error_counters::find(memcached_server_instance_st instance) const {
+        string name = (boost::format("%1%:%2%") %
+            memcached_server_name(instance) %
+            memcached_server_port(instance)).str();
+
+        for(uint32_t i = 0; i < m_count; ++i) {
+            if(m_rows[i].name == name) {
+                return i;
+            }
+        }
+
+        return m_count;
+    }
+
+    errors_t error_counters::snapshot() const {
+        errors_t result;
+
+        for(uint32_t i = 0; i <= m_count; ++i) {
+            for(int code = 0; code < MEMCACHED_MAXIMUM_RETURN; ++code) {
+                uint64_t count = m_rows[i].codes[code];
+
+                if(count) {
+                    result[m_rows[i].name][memcached_strerror(NULL, static_cast<memcached_return_t>(code))] = count;
+                }
+            }
+        }
+
+        return result;
+    }
+}}
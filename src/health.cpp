@@ -0,0 +1,151 @@
+#include "health.hpp"
+
+#include <boost/assign.hpp>
+#include <boost/format.hpp>
+
+namespace yandex { namespace memcached {
+    using namespace std;
+
+    health_monitor::health_monitor():
+        m_count(0),
+        m_down(0),
+        m_probes(0),
+        m_failed(0),
+        m_downs(0),
+        m_ups(0),
+        m_rejected(0) {}
+
+    health_monitor::~health_monitor() {
+        for(uint32_t i = 0; i < m_count; ++i) {
+            if(m_servers[i].probe) {
+                memcached_free(m_servers[i].probe);
+            }
+        }
+    }
+
+    void health_monitor::reset(const memcached_st* memcached) {
+        uint32_t count = memcached ? memcached_server_count(memcached) : 0;
+
+        for(uint32_t i = 0; i < m_count; ++i) {
+            if(m_servers[i].probe) {
+                memcached_free(m_servers[i].probe);
+            }
+        }
+
+        m_servers.reset(new server[count]);
+        m_count = count;
+        m_down = 0;
+
+        for(uint32_t i = 0; i < m_count; ++i) {
+            memcached_server_instance_st instance = memcached_server_instance_by_position(memcached, i);
+            server& s = m_servers[i];
+
+            s.name = (boost::format("%1%:%2%") %
+                memcached_server_name(instance) %
+                memcached_server_port(instance)).str();
+            s.failures = 0;
+            s.down = false;
+
+            // A handle of its own for every server, so that a probe only ever hits the one server,
+            // and the failures are never hidden by the failure limits of the request path
+            s.probe = memcached_create(NULL);
+
+            if(s.probe && memcached_server_add(s.probe, memcached_server_name(instance),
+                memcached_server_port(instance)) != MEMCACHED_SUCCESS)
+            {
+                memcached_free(s.probe);
+                s.probe = NULL;
+            }
+        }
+    }
+
+    void health_monitor::probe(uint32_t timeout, uint32_t failures) {
+        vector<pair<string, bool> > transitions;
+
+        for(uint32_t i = 0; i < m_count; ++i) {
+            server& s = m_servers[i];
+
+            if(!s.probe) {
+                continue;
+            }
+
+            memcached_behavior_set(s.probe, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, timeout);
+            memcached_behavior_set(s.probe, MEMCACHED_BEHAVIOR_POLL_TIMEOUT, timeout);
+
+            bool alive = memcached_version(s.probe) == MEMCACHED_SUCCESS;
+
+            boost::mutex::scoped_lock lock(m_mutex);
+
+            m_probes++;
+
+            if(alive) {
+                s.failures = 0;
+
+                if(s.down) {
+                    s.down = false;
+                    __sync_fetch_and_sub(&m_down, 1);
+                    m_ups++;
+                    transitions.push_back(make_pair(s.name, true));
+                }
+
+                continue;
+            }
+
+            // The next probe starts with a fresh connection
+            memcached_quit(s.probe);
+
+            m_failed++;
+
+            if(++s.failures >= failures && !s.down) {
+                s.down = true;
+                __sync_fetch_and_add(&m_down, 1);
+                m_downs++;
+                transitions.push_back(make_pair(s.name, false));
+            }
+        }
+
+        if(transitions.empty()) {
+            return;
+        }
+
+        vector<health_fn_t> subscribers;
+
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            subscribers = m_subscribers;
+        }
+
+        for(vector<pair<string, bool> >::const_iterator it = transitions.begin(); it != transitions.end(); ++it) {
+            for(vector<health_fn_t>::const_iterator subscriber = subscribers.begin(); subscriber != subscribers.end(); ++subscriber) {
+                (*subscriber)(it->first, it->second);
+            }
+        }
+    }
+
+    void health_monitor::subscribe(health_fn_t health_fn) {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_subscribers.push_back(health_fn);
+    }
+
+    map<string, bool> health_monitor::snapshot() const {
+        map<string, bool> result;
+
+        for(uint32_t i = 0; i < m_count; ++i) {
+            result[m_servers[i].name] = !m_servers[i].down;
+        }
+
+        return result;
+    }
+
+    map<string, uint64_t> health_monitor::counters() const {
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        return boost::assign::map_list_of
+            ("probes", m_probes)
+            ("probe-failures", m_failed)
+            ("down", static_cast<uint64_t>(m_down))
+            ("went-down", m_downs)
+            ("came-up", m_ups)
+            ("rejected", static_cast<uint64_t>(m_rejected));
+    }
+}}
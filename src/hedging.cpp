@@ -0,0 +1,315 @@
+#include "hedging.hpp"
+
+#include <algorithm>
+#include <unistd.h>
+#include <time.h>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/assign.hpp>
+
+namespace yandex { namespace memcached {
+    using namespace std;
+
+    namespace {
+        // The delay is recomputed every so many samples, from the latest ones
+        const size_t latency_window = 512;
+        const uint64_t latency_period = 64;
+
+        inline uint64_t microseconds() {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+
+            return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+        }
+
+        // The values are copied, as the fetched buffers are gone by the time the race is over
+        struct value_collector {
+            value_collector(map<string, pair<string, uint32_t> >& result_):
+                result(result_) {}
+
+            void operator()(const string& key, const char* value, size_t value_length, uint32_t codec, uint64_t) {
+                pair<string, uint32_t>& entry = result[key];
+
+                entry.first.assign(value, value_length);
+                entry.second = codec;
+            }
+
+            map<string, pair<string, uint32_t> >& result;
+        };
+    }
+
+    // Shared by the caller and the requests, which might outlive it when they lose
+    struct hedged_reader::race: private boost::noncopyable {
+        race(const cache_vector_t& keys_):
+            keys(keys_),
+            pending(0),
+            winner(none) {}
+
+        const cache_vector_t keys;
+        uint32_t pending;
+        leg_t winner;
+
+        // The values of the winner, or of the primary client when there's none
+        values_t values;
+
+        boost::mutex mutex;
+        boost::condition_variable done;
+    };
+
+    hedged_reader::hedged_reader(Client& primary, Client& backup, uint32_t percentile, uint32_t initial_delay,
+        uint32_t minimum_delay, uint32_t limit, uint32_t concurrency):
+            m_primary(primary),
+            m_backup(backup),
+            m_position(0),
+            m_sampled(0),
+            m_percentile(std::min<uint32_t>(percentile, 100)),
+            m_delay(std::max(initial_delay, minimum_delay)),
+            m_minimum_delay(minimum_delay),
+            m_limit(limit),
+            m_concurrency(std::max<uint32_t>(concurrency, 1)),
+            m_reading(0),
+            m_hedging(0),
+            m_reads(0),
+            m_hedged(0),
+            m_won(0),
+            m_suppressed(0),
+            m_direct(0),
+            m_pid(getpid()),
+            m_idle(0),
+            m_stopping(false)
+    {
+        m_samples.reserve(latency_window);
+    }
+
+    hedged_reader::~hedged_reader() {
+        {
+            boost::lock_guard<boost::mutex> lock(m_tasks_mutex);
+            m_stopping = true;
+        }
+
+        m_wakeup.notify_all();
+
+        if(m_pid != getpid()) {
+            return;
+        }
+
+        for(vector<boost::thread*>::iterator it = m_threads.begin(); it != m_threads.end(); ++it) {
+            (*it)->join();
+            delete *it;
+        }
+    }
+
+    bool hedged_reader::get_multi(const cache_vector_t& keys, fetch_fn_t fetch_fn) {
+        uint64_t delay;
+        bool direct;
+
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+
+            if(m_pid != getpid()) {
+                restart();
+            }
+
+            m_reads++;
+            direct = m_reading >= m_concurrency;
+
+            if(direct) {
+                m_direct++;
+            } else {
+                m_reading++;
+            }
+
+            delay = m_delay;
+        }
+
+        // Too many reads in flight already, so this one isn't hedged
+        if(direct) {
+            return m_primary.get_multi(keys, fetch_fn);
+        }
+
+        boost::shared_ptr<race> state = boost::make_shared<race>(keys);
+        bool late;
+
+        state->pending = 1;
+        dispatch(boost::bind(&hedged_reader::read, this, state, primary_leg));
+
+        {
+            boost::unique_lock<boost::mutex> lock(state->mutex);
+            boost::system_time until = boost::get_system_time() + boost::posix_time::microseconds(delay);
+
+            while(state->winner == none && state->pending && state->done.timed_wait(lock, until)) {}
+
+            late = (state->winner == none);
+        }
+
+        // Late, or failed already, in which case the backup client is the only hope
+        if(late) {
+            hedge(state);
+        }
+
+        values_t values;
+        leg_t winner;
+
+        {
+            boost::unique_lock<boost::mutex> lock(state->mutex);
+
+            while(state->winner == none && state->pending) {
+                state->done.wait(lock);
+            }
+
+            winner = state->winner;
+            values.swap(state->values);
+        }
+
+        if(winner == backup_leg) {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            m_won++;
+        }
+
+        for(values_t::const_iterator it = values.begin(); it != values.end(); ++it) {
+            fetch_fn(it->first, it->second.first.data(), it->second.first.length(), it->second.second, 0);
+        }
+
+        return winner != none;
+    }
+
+    counters_t hedged_reader::counters() const {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        return boost::assign::map_list_of
+            ("reads", m_reads)
+            ("hedged", m_hedged)
+            ("won", m_won)
+            ("suppressed", m_suppressed)
+            ("direct", m_direct)
+            ("inflight", static_cast<uint64_t>(m_hedging))
+            ("delay", m_delay);
+    }
+
+    void hedged_reader::read(boost::shared_ptr<race> state, leg_t leg) {
+        values_t values;
+        uint64_t start = microseconds();
+        bool complete = (leg == primary_leg ? m_primary : m_backup).get_multi(state->keys, value_collector(values));
+        uint64_t latency = microseconds() - start;
+
+        // The latencies are sampled from the complete requests, the late ones included,
+        // as the delay would never grow past its current value otherwise
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+
+            if(leg == primary_leg) {
+                m_reading--;
+                sample(latency);
+            } else {
+                m_hedging--;
+            }
+        }
+
+        boost::lock_guard<boost::mutex> lock(state->mutex);
+
+        state->pending--;
+
+        // A failed request never wins, but the hits of the primary one are better than nothing
+        if(state->winner == none && (complete || leg == primary_leg)) {
+            state->values.swap(values);
+
+            if(complete) {
+                state->winner = leg;
+            }
+        }
+
+        state->done.notify_all();
+    }
+
+    void hedged_reader::hedge(boost::shared_ptr<race> state) {
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+
+            if(m_hedging >= m_limit) {
+                m_suppressed++;
+                return;
+            }
+
+            m_hedging++;
+            m_hedged++;
+        }
+
+        {
+            boost::lock_guard<boost::mutex> lock(state->mutex);
+            state->pending++;
+        }
+
+        dispatch(boost::bind(&hedged_reader::read, this, state, backup_leg));
+    }
+
+    void hedged_reader::sample(uint64_t latency) {
+        if(m_samples.size() < latency_window) {
+            m_samples.push_back(latency);
+        } else {
+            m_samples[m_position] = latency;
+            m_position = (m_position + 1) % latency_window;
+        }
+
+        if(++m_sampled % latency_period) {
+            return;
+        }
+
+        vector<uint64_t> samples(m_samples);
+        size_t index = std::min(samples.size() - 1, samples.size() * m_percentile / 100);
+
+        nth_element(samples.begin(), samples.begin() + index, samples.end());
+        m_delay = std::max(m_minimum_delay, samples[index]);
+    }
+
+    void hedged_reader::restart() {
+        boost::lock_guard<boost::mutex> lock(m_tasks_mutex);
+
+        // Neither the threads nor the requests they were running have made it through the fork,
+        // and the handles of the threads can't be joined or detached, so they're leaked
+        m_threads.clear();
+        m_tasks.clear();
+        m_idle = 0;
+        m_reading = 0;
+        m_hedging = 0;
+        m_pid = getpid();
+    }
+
+    void hedged_reader::dispatch(const boost::function<void ()>& task) {
+        boost::lock_guard<boost::mutex> lock(m_tasks_mutex);
+
+        m_tasks.push_back(task);
+
+        if(m_idle < m_tasks.size() && m_threads.size() < m_concurrency + m_limit) {
+            m_threads.push_back(new boost::thread(&hedged_reader::work, this));
+        } else {
+            m_wakeup.notify_one();
+        }
+    }
+
+    void hedged_reader::work() {
+        boost::unique_lock<boost::mutex> lock(m_tasks_mutex);
+
+        while(true) {
+            while(m_tasks.empty() && !m_stopping) {
+                m_idle++;
+                m_wakeup.wait(lock);
+                m_idle--;
+            }
+
+            // The requests in flight are completed first
+            if(m_tasks.empty()) {
+                return;
+            }
+
+            boost::function<void ()> task;
+
+            task.swap(m_tasks.front());
+            m_tasks.pop_front();
+
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+}}
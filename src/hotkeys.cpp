@@ -0,0 +1,210 @@
+#include "hotkeys.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/static_assert.hpp>
+
+namespace yandex { namespace memcached {
+    using namespace std;
+
+    BOOST_STATIC_ASSERT(sizeof(hot_keys_header) == 16);
+
+    namespace {
+        typedef pair<uint64_t, string> ranked_key;
+
+        bool hotter(const ranked_key& lhs, const ranked_key& rhs) {
+            return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+        }
+
+        bool colder_last(const pair<uint64_t, map<string, uint64_t>::iterator>& lhs,
+            const pair<uint64_t, map<string, uint64_t>::iterator>& rhs)
+        {
+            return lhs.first > rhs.first;
+        }
+    }
+
+    hot_keys::hot_keys():
+        m_capacity(0),
+        m_sample(1),
+        m_seen(0) {}
+
+    void hot_keys::reset(uint32_t capacity, uint32_t sample) {
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        m_counts.clear();
+        m_sample = std::max<uint32_t>(sample, 1);
+        m_capacity = capacity;
+    }
+
+    void hot_keys::account(const string& key) {
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        // Disabled since the check
+        if(!m_capacity) {
+            return;
+        }
+
+        m_counts[key]++;
+
+        if(m_counts.size() >= m_capacity * 2) {
+            prune();
+        }
+    }
+
+    void hot_keys::prune() {
+        typedef map<string, uint64_t>::iterator entry;
+        vector<pair<uint64_t, entry> > ranked;
+
+        ranked.reserve(m_counts.size());
+
+        for(entry it = m_counts.begin(); it != m_counts.end(); ++it) {
+            ranked.push_back(make_pair(it->second, it));
+        }
+
+        // Exactly the capacity is kept, the ties with the coldest survivor are broken arbitrarily
+        nth_element(ranked.begin(), ranked.begin() + (m_capacity - 1), ranked.end(), colder_last);
+
+        for(size_t i = m_capacity; i < ranked.size(); ++i) {
+            m_counts.erase(ranked[i].second);
+        }
+
+        // The counts decay down to zero, so the keys nobody has come back for go too
+        for(size_t i = 0; i < m_capacity; ++i) {
+            entry it = ranked[i].second;
+
+            if((it->second /= 2) == 0) {
+                m_counts.erase(it);
+            }
+        }
+    }
+
+    vector<string> hot_keys::top(uint32_t count) const {
+        vector<ranked_key> ranked;
+
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+
+            ranked.reserve(m_counts.size());
+
+            for(map<string, uint64_t>::const_iterator it = m_counts.begin(); it != m_counts.end(); ++it) {
+                ranked.push_back(make_pair(it->second, it->first));
+            }
+        }
+
+        count = std::min<size_t>(count, ranked.size());
+        partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(), hotter);
+
+        vector<string> result;
+
+        result.reserve(count);
+
+        for(uint32_t i = 0; i < count; ++i) {
+            result.push_back(ranked[i].second);
+        }
+
+        return result;
+    }
+
+    bool hot_keys::save(const string& path) const {
+        vector<string> keys = top(m_capacity);
+        string temporary = path + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+
+        if(!file) {
+            return false;
+        }
+
+        hot_keys_header header;
+
+        memcpy(header.magic, hot_keys_magic, sizeof(header.magic));
+        header.version = hot_keys_version;
+        header.count = keys.size();
+
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+        for(vector<string>::const_iterator it = keys.begin(); written && it != keys.end(); ++it) {
+            uint16_t length = std::min<size_t>(it->length(), numeric_limits<uint16_t>::max());
+
+            written = fwrite(&length, sizeof(length), 1, file) == 1 &&
+                fwrite(it->data(), 1, length, file) == length;
+        }
+
+        written = fclose(file) == 0 && written;
+
+        if(!written || rename(temporary.c_str(), path.c_str()) != 0) {
+            unlink(temporary.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    bool hot_keys::load(const string& path, vector<string>& keys) {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+
+        keys.clear();
+
+        if(fd < 0) {
+            return false;
+        }
+
+        if(fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(hot_keys_header)) {
+            close(fd);
+            return false;
+        }
+
+        void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if(mapped == MAP_FAILED) {
+            return false;
+        }
+
+        const char* data = static_cast<const char*>(mapped);
+        const char* end = data + st.st_size;
+        hot_keys_header header;
+
+        memcpy(&header, data, sizeof(header));
+
+        bool valid = memcmp(header.magic, hot_keys_magic, sizeof(header.magic)) == 0 &&
+            header.version == hot_keys_version;
+
+        // The count isn't trusted for more than the file can hold
+        if(valid) {
+            keys.reserve(std::min<size_t>(header.count, st.st_size / sizeof(uint16_t)));
+        }
+
+        // A truncated snapshot still yields the keys before the damage
+        for(const char* position = data + sizeof(header); valid && keys.size() < header.count; ) {
+            uint16_t length;
+
+            if(end - position < static_cast<ptrdiff_t>(sizeof(length))) {
+                break;
+            }
+
+            memcpy(&length, position, sizeof(length));
+            position += sizeof(length);
+
+            if(end - position < length) {
+                break;
+            }
+
+            keys.push_back(string(position, length));
+            position += length;
+        }
+
+        munmap(mapped, st.st_size);
+
+        return valid;
+    }
+}}
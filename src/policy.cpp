@@ -0,0 +1,110 @@
+#include "policy.hpp"
+
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+namespace yandex { namespace memcached {
+    using namespace std;
+
+    namespace {
+        // Orders the prefixes against the first characters of the key
+        struct prefix_less {
+            prefix_less(const string& key_, size_t length_):
+                key(key_),
+                length(length_) {}
+
+            bool operator()(const pair<string, policy>& entry, int) const {
+                return entry.first.compare(0, string::npos, key, 0, length) < 0;
+            }
+
+            const string& key;
+            size_t length;
+        };
+
+        bool by_prefix(const pair<string, policy>& lhs, const pair<string, policy>& rhs) {
+            return lhs.first < rhs.first;
+        }
+    }
+
+    policy::policy():
+        expiration_minimum(120),
+        expiration_maximum(180),
+        compression_threshold(numeric_limits<uint32_t>::max()),
+        replication_factor(1),
+        write_behind(true) {}
+
+    bool policy::set(const string& name, uint64_t value) {
+        if(name == "expiration-minimum") {
+            expiration_minimum = value;
+        } else if(name == "expiration-maximum") {
+            expiration_maximum = value;
+        } else if(name == "compression-threshold") {
+            compression_threshold = value;
+        } else if(name == "replication-factor") {
+            replication_factor = std::max<uint64_t>(value, 1);
+        } else if(name == "write-behind") {
+            write_behind = value;
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+    time_t policy::expiration(time_t expire) const {
+        if(expire) {
+            return expire;
+        }
+
+        if(expiration_maximum <= expiration_minimum) {
+            return expiration_minimum;
+        }
+
+        return rand() % (expiration_maximum - expiration_minimum) + expiration_minimum;
+    }
+
+    policy_table::policy_table():
+        m_replication(1) {}
+
+    void policy_table::reset(const policy& defaults, const policy_options_t& options) {
+        m_entries.clear();
+        m_lengths.clear();
+        m_defaults = defaults;
+        m_replication = defaults.replication_factor;
+
+        for(policy_options_t::const_iterator it = options.begin(); it != options.end(); ++it) {
+            policy entry(defaults);
+
+            for(map<string, uint64_t>::const_iterator setting = it->second.begin(); setting != it->second.end(); ++setting) {
+                entry.set(setting->first, setting->second);
+            }
+
+            m_entries.push_back(make_pair(it->first, entry));
+            m_lengths.push_back(it->first.length());
+            m_replication = std::max(m_replication, entry.replication_factor);
+        }
+
+        sort(m_entries.begin(), m_entries.end(), by_prefix);
+        sort(m_lengths.begin(), m_lengths.end(), greater<size_t>());
+        m_lengths.erase(unique(m_lengths.begin(), m_lengths.end()), m_lengths.end());
+    }
+
+    const policy& policy_table::resolve(const string& key) const {
+        for(vector<size_t>::const_iterator length = m_lengths.begin(); length != m_lengths.end(); ++length) {
+            if(*length > key.length()) {
+                continue;
+            }
+
+            entries_t::const_iterator it = lower_bound(m_entries.begin(), m_entries.end(), 0,
+                prefix_less(key, *length));
+
+            if(it != m_entries.end() && it->first.length() == *length && key.compare(0, *length, it->first) == 0) {
+                return it->second;
+            }
+        }
+
+        return m_defaults;
+    }
+}}
@@ -13,56 +13,155 @@ namespace yandex { namespace memcached { namespace python {
         }
     }
 
-    str ClientWrapper::get(const str& key) const {    
-        std::string result, k = extract<std::string>(key);
+    namespace {
+        inline object decode(const Codec* codec, const char* value, size_t value_length, uint32_t flags) {
+            return codec ? codec->decode(value, value_length, flags) : str(value, value_length);
+        }
+
+        // These build the Python objects straight from the fetched or decompressed
+        // buffers, grabbing the GIL back only for the duration of the copy
+        struct value_builder {
+            value_builder(object& result_, const Codec* codec_):
+                result(result_),
+                codec(codec_) {}
+
+            void operator()(const std::string&, const char* value, size_t value_length, uint32_t flags, uint64_t) {
+                scoped_gil_locker lock;
+                result = decode(codec, value, value_length, flags);
+            }
+
+            object& result;
+            const Codec* codec;
+        };
+
+        struct dict_builder {
+            dict_builder(dict& result_, const Codec* codec_, bool with_cas_ = false):
+                result(result_),
+                codec(codec_),
+                with_cas(with_cas_) {}
+
+            void operator()(const std::string& key, const char* value, size_t value_length, uint32_t flags, uint64_t cas) {
+                scoped_gil_locker lock;
+
+                if(with_cas) {
+                    result.setdefault(key, make_tuple(decode(codec, value, value_length, flags), cas));
+                } else {
+                    result.setdefault(key, decode(codec, value, value_length, flags));
+                }
+            }
+
+            dict& result;
+            const Codec* codec;
+            bool with_cas;
+        };
+    }
+
+    object ClientWrapper::get(const str& key, uint32_t timeout) const {    
+        std::string k = extract<std::string>(key);
+        object result;
 
         {
             scoped_gil_unlocker scoped;
-            result = m_client->get(k);
+            m_client->get(k, value_builder(result, m_serialization ? &m_codec : NULL), timeout);
         }
 
-        return str(result);
+        return result;
     } 
     
-    dict ClientWrapper::get_multi(const list& keys) const {
-        cache_map_t cache_map;
+    dict ClientWrapper::get_multi(const list& keys, uint32_t timeout) const {
         stl_input_iterator<std::string> begin(keys), end;
-        cache_vector_t cache_vector(begin, end);
+        cache_vector_t cache_vector(begin, end), timedout;
+        dict results;
 
         {
             scoped_gil_unlocker scoped;
-            cache_map = m_client->get_multi(cache_vector);
+            m_client->get_multi(cache_vector, dict_builder(results, m_serialization ? &m_codec : NULL),
+                timeout, timedout);
         }
 
+        return results;
+    }
+
+    tuple ClientWrapper::get_multi_partial(const list& keys, uint32_t timeout) const {
+        stl_input_iterator<std::string> begin(keys), end;
+        cache_vector_t cache_vector(begin, end), timedout;
         dict results;
+
+        {
+            scoped_gil_unlocker scoped;
+            m_client->get_multi(cache_vector, dict_builder(results, m_serialization ? &m_codec : NULL),
+                timeout, timedout);
+        }
+
+        list late;
+
+        for(cache_vector_t::const_iterator it = timedout.begin(); it != timedout.end(); ++it) {
+            late.append(*it);
+        }
+
+        return make_tuple(results, late);
+    }
+
+    bool ClientWrapper::store(store_fn_t store_fn, const str& key, const object& value, time_t expire, uint32_t timeout) {
+        std::string k = extract<std::string>(key), v;
+        uint32_t codec = encode(value, v);
         
-        for(cache_map_t::const_iterator it = cache_map.begin(); it != cache_map.end(); ++it) {
-            results.setdefault(it->first, it->second);
+        {
+            scoped_gil_unlocker scoped;
+            return store_fn(m_client, k, v, expire, codec, timeout);
+        }
+    }
+
+    dict ClientWrapper::store(bulk_store_fn_t store_fn, const dict& items, time_t expire, uint32_t timeout) {
+        // Items are batched by codec, as it's stored in the item flags
+        std::map<uint32_t, cache_map_t> batches;
+        stl_input_iterator<tuple> begin(items.iteritems()), end;
+        std::string v;
+
+        for(stl_input_iterator<tuple> it = begin; it != end; ++it) {
+            uint32_t codec = encode((*it)[1], v);
+            batches[codec].insert(std::make_pair(extract<std::string>((*it)[0])(), v));
+        }
+        
+        {
+            scoped_gil_unlocker scoped;
+
+            for(std::map<uint32_t, cache_map_t>::iterator batch = batches.begin(); batch != batches.end(); ++batch) {
+                store_fn(m_client, batch->second, expire, batch->first, timeout);
+            }
+        }
+
+        dict results;
+        
+        for(std::map<uint32_t, cache_map_t>::const_iterator batch = batches.begin(); batch != batches.end(); ++batch) {
+            for(cache_map_t::const_iterator it = batch->second.begin(); it != batch->second.end(); ++it) {
+                results.setdefault(it->first, items.get(it->first));
+            }
         }
 
         return results;
     }
 
-    bool ClientWrapper::store(store_fn_t store_fn, const str& key, const str& value, time_t expire) {
+    bool ClientWrapper::concat(concat_fn_t concat_fn, const str& key, const str& value) {
         std::string k = extract<std::string>(key);
         std::string v = extract<std::string>(value);
-        
+
         {
             scoped_gil_unlocker scoped;
-            return store_fn(m_client, k, v, expire);
+            return concat_fn(m_client, k, v);
         }
     }
 
-    dict ClientWrapper::store(bulk_store_fn_t store_fn, const dict& items, time_t expire) {
+    dict ClientWrapper::concat(bulk_concat_fn_t concat_fn, const dict& items) {
         cache_map_t cache_map(dict_to_map<cache_map_t::key_type, cache_map_t::mapped_type>(items));
-        
+
         {
             scoped_gil_unlocker scoped;
-            store_fn(m_client, cache_map, expire);
+            concat_fn(m_client, cache_map);
         }
 
         dict results;
-        
+
         for(cache_map_t::const_iterator it = cache_map.begin(); it != cache_map.end(); ++it) {
             results.setdefault(it->first, it->second);
         }
@@ -70,6 +169,153 @@ namespace yandex { namespace memcached { namespace python {
         return results;
     }
 
+    tuple ClientWrapper::gets(const str& key) const {
+        dict results = gets_multi(list(make_tuple(key)));
+
+        return extract<tuple>(results.get(key, make_tuple(object(), 0)));
+    }
+
+    dict ClientWrapper::gets_multi(const list& keys) const {
+        stl_input_iterator<std::string> begin(keys), end;
+        cache_vector_t cache_vector(begin, end);
+        dict results;
+
+        {
+            scoped_gil_unlocker scoped;
+            m_client->gets_multi(cache_vector, dict_builder(results, m_serialization ? &m_codec : NULL, true));
+        }
+
+        return results;
+    }
+
+    bool ClientWrapper::cas(const str& key, const object& value, uint64_t cas, time_t expire) {
+        std::string k = extract<std::string>(key), v;
+        uint32_t codec = encode(value, v);
+
+        {
+            scoped_gil_unlocker scoped;
+            return m_client->cas(k, v, cas, expire, codec);
+        }
+    }
+
+    dict ClientWrapper::cas_multi(const dict& items, time_t expire) {
+        std::map<uint32_t, cas_map_t> batches;
+        stl_input_iterator<tuple> begin(items.iteritems()), end;
+        std::string v;
+
+        for(stl_input_iterator<tuple> it = begin; it != end; ++it) {
+            tuple item = extract<tuple>((*it)[1]);
+            uint32_t codec = encode(item[0], v);
+
+            batches[codec].insert(std::make_pair(
+                extract<std::string>((*it)[0])(),
+                cas_value_t(v, extract<uint64_t>(item[1])())));
+        }
+
+        {
+            scoped_gil_unlocker scoped;
+
+            for(std::map<uint32_t, cas_map_t>::iterator batch = batches.begin(); batch != batches.end(); ++batch) {
+                m_client->cas_multi(batch->second, expire, batch->first);
+            }
+        }
+
+        dict results;
+
+        for(std::map<uint32_t, cas_map_t>::const_iterator batch = batches.begin(); batch != batches.end(); ++batch) {
+            for(cas_map_t::const_iterator it = batch->second.begin(); it != batch->second.end(); ++it) {
+                results.setdefault(it->first, items.get(it->first));
+            }
+        }
+
+        return results;
+    }
+
+    object ClientWrapper::arithmetic(bool increment, const str& key, uint64_t delta, const object& initial, time_t expire) {
+        std::string k = extract<std::string>(key);
+        uint64_t value;
+        bool success;
+
+        if(initial.is_none()) {
+            scoped_gil_unlocker scoped;
+            success = increment ?
+                m_client->incr(k, delta, value) :
+                m_client->decr(k, delta, value);
+        } else if(m_serialization) {
+            uint64_t i = extract<uint64_t>(initial);
+            std::string v = extract<std::string>(str(initial));
+
+            // The counters are created with a plain add, so that they're read back as integers
+            // just like the stored ones, rather than as strings with the flags left blank
+            {
+                scoped_gil_unlocker scoped;
+                success = increment ?
+                    m_client->incr(k, delta, value) :
+                    m_client->decr(k, delta, value);
+
+                if(!success && m_client->add(k, v, expire, codecs::integer)) {
+                    success = true;
+                    value = i;
+                } else if(!success) {
+                    // Somebody else has just created it
+                    success = increment ?
+                        m_client->incr(k, delta, value) :
+                        m_client->decr(k, delta, value);
+                }
+            }
+        } else {
+            uint64_t i = extract<uint64_t>(initial);
+
+            {
+                scoped_gil_unlocker scoped;
+                success = increment ?
+                    m_client->incr(k, delta, i, value, expire) :
+                    m_client->decr(k, delta, i, value, expire);
+            }
+        }
+
+        return success ? object(value) : object();
+    }
+
+    bool ClientWrapper::touch(const str& key, time_t expire) {
+        std::string k = extract<std::string>(key);
+
+        {
+            scoped_gil_unlocker scoped;
+            return m_client->touch(k, expire);
+        }
+    }
+
+    list ClientWrapper::touch_multi(const list& keys, time_t expire) {
+        stl_input_iterator<std::string> begin(keys), end;
+        cache_vector_t cache_vector(begin, end);
+
+        {
+            scoped_gil_unlocker scoped;
+            m_client->touch_multi(cache_vector, expire);
+        }
+
+        list results;
+
+        for(cache_vector_t::const_iterator it = cache_vector.begin(); it != cache_vector.end(); ++it) {
+            results.append(*it);
+        }
+
+        return results;
+    }
+
+    object ClientWrapper::get_and_touch(const str& key, time_t expire) {
+        std::string k = extract<std::string>(key);
+        object result;
+
+        {
+            scoped_gil_unlocker scoped;
+            m_client->get_and_touch(k, expire, value_builder(result, m_serialization ? &m_codec : NULL));
+        }
+
+        return result;
+    }
+
     bool ClientWrapper::remove(const str& key) {
         std::string k = extract<std::string>(key);
 
@@ -97,6 +343,15 @@ namespace yandex { namespace memcached { namespace python {
         return results;
     }
 
+    uint32_t ClientWrapper::encode(const object& value, std::string& result) const {
+        if(m_serialization) {
+            return m_codec.encode(value, result);
+        }
+
+        result = extract<std::string>(value);
+        return 0;
+    }
+
     list ClientWrapper::get_stats() const {
         list results;
 
@@ -115,12 +370,235 @@ namespace yandex { namespace memcached { namespace python {
         return results;
     }
 
-    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(set_overloads, set, 2, 3)
-    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(set_multi_overloads, set_multi, 1, 2)
-    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(add_overloads, add, 2, 3)
-    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(add_multi_overloads, add_multi, 1, 2)
-    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(replace_overloads, replace, 2, 3)
-    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(replace_multi_overloads, replace_multi, 1, 2)
+    dict ClientWrapper::get_errors() const {
+        dict results;
+
+        errors_t errors = m_client->get_errors();
+
+        for(errors_t::const_iterator it = errors.begin(); it != errors.end(); ++it) {
+            dict counters;
+
+            for(std::map<std::string, uint64_t>::const_iterator kv = it->second.begin(); kv != it->second.end(); ++kv) {
+                counters[kv->first] = kv->second;
+            }
+
+            results[it->first] = counters;
+        }
+
+        return results;
+    }
+
+    object ClientWrapper::get_cluster_stats() const {
+        cluster_stats_ptr stats = m_client->get_cluster_stats();
+
+        if(!stats) {
+            return object();
+        }
+
+        dict results;
+
+        for(std::vector<server_stats>::const_iterator it = stats->servers.begin(); it != stats->servers.end(); ++it) {
+            dict server, slabs;
+
+            server["alive"] = it->alive;
+            server["uptime"] = it->uptime;
+            server["items"] = it->items;
+            server["bytes"] = it->bytes;
+            server["limit_maxbytes"] = it->limit;
+            server["connections"] = it->connections;
+            server["cmd_get"] = it->gets;
+            server["cmd_set"] = it->sets;
+            server["get_hits"] = it->hits;
+            server["get_misses"] = it->misses;
+            server["evictions"] = it->evictions;
+            server["bytes_read"] = it->bytes_read;
+            server["bytes_written"] = it->bytes_written;
+            server["hit_ratio"] = it->hit_ratio;
+            server["gets_per_second"] = it->gets_per_second;
+            server["sets_per_second"] = it->sets_per_second;
+            server["evictions_per_second"] = it->evictions_per_second;
+            server["bytes_read_per_second"] = it->bytes_read_per_second;
+            server["bytes_written_per_second"] = it->bytes_written_per_second;
+            server["share"] = it->share;
+
+            for(slabs_t::const_iterator slab = it->slabs.begin(); slab != it->slabs.end(); ++slab) {
+                dict counters;
+
+                counters["chunk_size"] = slab->second.chunk_size;
+                counters["chunks_per_page"] = slab->second.chunks_per_page;
+                counters["total_pages"] = slab->second.total_pages;
+                counters["total_chunks"] = slab->second.total_chunks;
+                counters["used_chunks"] = slab->second.used_chunks;
+                counters["free_chunks"] = slab->second.free_chunks;
+                counters["mem_requested"] = slab->second.requested;
+                counters["items"] = slab->second.items;
+                counters["age"] = slab->second.age;
+                counters["evicted"] = slab->second.evicted;
+                counters["outofmemory"] = slab->second.outofmemory;
+                counters["wasted"] = slab->second.wasted;
+                counters["waste"] = slab->second.waste;
+                counters["evictions_per_second"] = slab->second.evictions_per_second;
+
+                slabs[slab->first] = counters;
+            }
+
+            server["slabs"] = slabs;
+            results[it->name] = server;
+        }
+
+        return make_tuple(stats->sampled, results);
+    }
+
+    dict ClientWrapper::get_write_stats() const {
+        dict results;
+
+        counters_t counters = m_client->get_write_stats();
+
+        for(counters_t::const_iterator it = counters.begin(); it != counters.end(); ++it) {
+            results[it->first] = it->second;
+        }
+
+        return results;
+    }
+
+    dict ClientWrapper::warm(const std::string& path, uint32_t chunk) const {
+        dict results;
+
+        {
+            scoped_gil_unlocker scoped;
+            m_client->warm(path, dict_builder(results, m_serialization ? &m_codec : NULL), chunk);
+        }
+
+        return results;
+    }
+
+    dict ClientWrapper::get_health() const {
+        dict results;
+
+        std::map<std::string, bool> health = m_client->get_health();
+
+        for(std::map<std::string, bool>::const_iterator it = health.begin(); it != health.end(); ++it) {
+            results[it->first] = it->second;
+        }
+
+        return results;
+    }
+
+    dict ClientWrapper::get_health_stats() const {
+        dict results;
+
+        counters_t counters = m_client->get_health_stats();
+
+        for(counters_t::const_iterator it = counters.begin(); it != counters.end(); ++it) {
+            results[it->first] = it->second;
+        }
+
+        return results;
+    }
+
+    dict HedgerWrapper::get_multi(const list& keys) {
+        stl_input_iterator<std::string> begin(keys), end;
+        cache_vector_t cache_vector(begin, end);
+        dict results;
+
+        {
+            scoped_gil_unlocker scoped;
+            m_reader.get_multi(cache_vector,
+                dict_builder(results, m_primary.m_serialization ? &m_primary.m_codec : NULL));
+        }
+
+        return results;
+    }
+
+    dict HedgerWrapper::get_stats() const {
+        dict results;
+
+        counters_t counters = m_reader.counters();
+
+        for(counters_t::const_iterator it = counters.begin(); it != counters.end(); ++it) {
+            results[it->first] = it->second;
+        }
+
+        return results;
+    }
+
+    dict ClientWrapper::get_batch_stats() const {
+        dict results;
+
+        counters_t counters = m_client->get_batch_stats();
+
+        for(counters_t::const_iterator it = counters.begin(); it != counters.end(); ++it) {
+            results[it->first] = it->second;
+        }
+
+        return results;
+    }
+
+    str ClientWrapper::namespaced_key(const str& ns, const str& key) {
+        std::string n = extract<std::string>(ns), k = extract<std::string>(key), result;
+
+        {
+            scoped_gil_unlocker scoped;
+            result = m_client->namespaced_key(n, k);
+        }
+
+        return str(result);
+    }
+
+    list ClientWrapper::namespaced_keys(const list& keys) {
+        namespaced_vector_t namespaced_vector;
+        cache_vector_t cache_vector;
+        stl_input_iterator<tuple> begin(keys), end;
+
+        for(stl_input_iterator<tuple> it = begin; it != end; ++it) {
+            namespaced_vector.push_back(std::make_pair(
+                extract<std::string>((*it)[0])(),
+                extract<std::string>((*it)[1])()));
+        }
+
+        {
+            scoped_gil_unlocker scoped;
+            cache_vector = m_client->namespaced_keys(namespaced_vector);
+        }
+
+        list results;
+
+        for(cache_vector_t::const_iterator it = cache_vector.begin(); it != cache_vector.end(); ++it) {
+            results.append(*it);
+        }
+
+        return results;
+    }
+
+    bool ClientWrapper::invalidate_namespace(const str& ns) {
+        std::string n = extract<std::string>(ns);
+
+        {
+            scoped_gil_unlocker scoped;
+            return m_client->invalidate_namespace(n);
+        }
+    }
+
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(get_overloads, get, 1, 2)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(get_multi_overloads, get_multi, 1, 2)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(set_overloads, set, 2, 4)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(set_multi_overloads, set_multi, 1, 3)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(set_async_overloads, set_async, 2, 3)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(start_trace_overloads, start_trace, 1, 2)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(snapshot_hot_keys_overloads, snapshot_hot_keys, 1, 2)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(warm_overloads, warm, 1, 2)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(set_multi_async_overloads, set_multi_async, 1, 2)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(add_overloads, add, 2, 4)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(add_multi_overloads, add_multi, 1, 3)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(replace_overloads, replace, 2, 4)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(replace_multi_overloads, replace_multi, 1, 3)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(cas_overloads, cas, 3, 4)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(cas_multi_overloads, cas_multi, 1, 2)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(incr_overloads, incr, 1, 4)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(decr_overloads, decr, 1, 4)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(touch_overloads, touch, 1, 2)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(touch_multi_overloads, touch_multi, 1, 2)
+    BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(get_and_touch_overloads, get_and_touch, 1, 2)
 
     BOOST_PYTHON_MODULE(_memcached) {
         char* logging_config = getenv("MEMCACHED_LOGGING_CONFIG");
@@ -145,38 +623,130 @@ namespace yandex { namespace memcached { namespace python {
                 "Gets the server group locality ratio",
                 args("self"))
 
+            .def("serialization", &ClientWrapper::serialization,
+                "Checks whether non-string values are serialized",
+                args("self"))
+
+            .def("set_serialization", &ClientWrapper::set_serialization,
+                "Enables or disables the serialization of non-string values",
+                args("self", "enabled"))
+
             .def("get", &ClientWrapper::get,
-                "Fetches a single value from the cache",
-                args("self", "key"))
+                get_overloads("Fetches a single value from the cache",
+                args("key", "timeout")))
             
             .def("get_multi", &ClientWrapper::get_multi,
-                "Fetches multiple values from  the cache",
-                args("self", "keys"))
+                get_multi_overloads("Fetches multiple values from  the cache",
+                args("keys", "timeout")))
+
+            .def("get_multi_partial", &ClientWrapper::get_multi_partial,
+                "Fetches multiple values within the timeout, returning the late keys along with them",
+                args("self", "keys", "timeout"))
             
             .def("set", &ClientWrapper::set,
                 set_overloads("Stores the value with specified key to the cache",
-                args("key", "value", "expire")))
+                args("key", "value", "expire", "timeout")))
             
             .def("set_multi", &ClientWrapper::set_multi,
                 set_multi_overloads("Stores multiple items to the cache",
-                args("items", "expire")))
+                args("items", "expire", "timeout")))
             
+            .def("set_async", &ClientWrapper::set_async,
+                set_async_overloads("Queues the value with specified key for the background writer",
+                args("key", "value", "expire")))
+
+            .def("set_multi_async", &ClientWrapper::set_multi_async,
+                set_multi_async_overloads("Queues multiple items for the background writer",
+                args("items", "expire")))
+
+            .def("flush_writes", &ClientWrapper::flush_writes,
+                "Blocks until the queued writes have been sent",
+                args("self"))
+
+            .def("get_write_stats", &ClientWrapper::get_write_stats,
+                "Fetch the write-behind counters",
+                args("self"))
+
+            .def("get_batch_stats", &ClientWrapper::get_batch_stats,
+                "Fetch the get batching counters",
+                args("self"))
+
+            .def("get_health", &ClientWrapper::get_health,
+                "Fetch whether every server is up, according to the health prober",
+                args("self"))
+
+            .def("get_health_stats", &ClientWrapper::get_health_stats,
+                "Fetch the health probing counters",
+                args("self"))
+
             .def("add", &ClientWrapper::add,
                 add_overloads("Stores the value with specified key to the cache if its not there yet",
-                args("key", "value", "expire")))
+                args("key", "value", "expire", "timeout")))
             
             .def("add_multi", &ClientWrapper::add_multi,
                 add_multi_overloads("Stores multiple items to the cache if they are not there yet",
-                args("items", "expire")))
+                args("items", "expire", "timeout")))
             
             .def("replace", &ClientWrapper::replace,
                 replace_overloads("Replaces the value with specified key to the cache if it's there",
-                args("key", "value", "expire")))
+                args("key", "value", "expire", "timeout")))
             
             .def("replace_multi", &ClientWrapper::replace_multi,
                 replace_multi_overloads("Stores multiple items to the cache if they're there",
+                args("items", "expire", "timeout")))
+
+            .def("append", &ClientWrapper::append,
+                "Appends the data to the existing value with specified key",
+                args("self", "key", "value"))
+
+            .def("append_multi", &ClientWrapper::append_multi,
+                "Appends the data to multiple existing values",
+                args("self", "items"))
+
+            .def("prepend", &ClientWrapper::prepend,
+                "Prepends the data to the existing value with specified key",
+                args("self", "key", "value"))
+
+            .def("prepend_multi", &ClientWrapper::prepend_multi,
+                "Prepends the data to multiple existing values",
+                args("self", "items"))
+
+            .def("gets", &ClientWrapper::gets,
+                "Fetches a single value from the cache along with its CAS token",
+                args("self", "key"))
+
+            .def("gets_multi", &ClientWrapper::gets_multi,
+                "Fetches multiple values from the cache along with their CAS tokens",
+                args("self", "keys"))
+
+            .def("cas", &ClientWrapper::cas,
+                cas_overloads("Stores the value with specified key to the cache if it wasn't modified since fetched",
+                args("key", "value", "cas", "expire")))
+
+            .def("cas_multi", &ClientWrapper::cas_multi,
+                cas_multi_overloads("Stores multiple (value, cas) items to the cache if they weren't modified since fetched",
                 args("items", "expire")))
+
+            .def("incr", &ClientWrapper::incr,
+                incr_overloads("Increments the counter, creating it with the initial value if given",
+                args("key", "delta", "initial", "expire")))
+
+            .def("decr", &ClientWrapper::decr,
+                decr_overloads("Decrements the counter, creating it with the initial value if given",
+                args("key", "delta", "initial", "expire")))
             
+            .def("touch", &ClientWrapper::touch,
+                touch_overloads("Extends the lifetime of the specified key",
+                args("key", "expire")))
+
+            .def("touch_multi", &ClientWrapper::touch_multi,
+                touch_multi_overloads("Extends the lifetime of a set of keys",
+                args("keys", "expire")))
+
+            .def("get_and_touch", &ClientWrapper::get_and_touch,
+                get_and_touch_overloads("Fetches a single value from the cache and extends its lifetime",
+                args("key", "expire")))
+
             .def("delete", &ClientWrapper::remove,
                 "Invalidates the specified key",
                 args("self", "key"))
@@ -191,6 +761,62 @@ namespace yandex { namespace memcached { namespace python {
 
             .def("get_stats", &ClientWrapper::get_stats,
                 "Fetch server pool statistics",
+                args("self"))
+
+            .def("get_errors", &ClientWrapper::get_errors,
+                "Fetch the failure counters by server and by reason",
+                args("self"))
+
+            .def("get_cluster_stats", &ClientWrapper::get_cluster_stats,
+                "Fetch the latest (timestamp, stats by server) sample of the background collector, if any",
+                args("self"))
+
+            .def("save_hot_keys", &ClientWrapper::save_hot_keys,
+                "Saves the snapshot of the most accessed keys",
+                args("self", "path"))
+
+            .def("snapshot_hot_keys", &ClientWrapper::snapshot_hot_keys,
+                snapshot_hot_keys_overloads("Saves the hot keys snapshot on destruction, and periodically if an interval is given",
+                args("path", "interval")))
+
+            .def("warm", &ClientWrapper::warm,
+                warm_overloads("Prefetches the keys of a hot keys snapshot, returning the values found",
+                args("path", "chunk")))
+
+            .def("start_trace", &ClientWrapper::start_trace,
+                start_trace_overloads("Records every operation into a binary trace file for memcached-replay",
+                args("path", "capacity")))
+
+            .def("stop_trace", &ClientWrapper::stop_trace,
+                "Stops recording and flushes the trace file",
+                args("self"))
+
+            .def("namespaced_key", &ClientWrapper::namespaced_key,
+                "Composes the key within the current version of the namespace",
+                args("self", "ns", "key"))
+
+            .def("namespaced_keys", &ClientWrapper::namespaced_keys,
+                "Composes a list of (namespace, key) pairs, looking the versions up in one go",
+                args("self", "keys"))
+
+            .def("invalidate_namespace", &ClientWrapper::invalidate_namespace,
+                "Invalidates every key in the namespace",
+                args("self", "ns"));
+
+        // The hedger keeps both clients alive, as its requests might still be running on them
+        class_<HedgerWrapper, boost::noncopyable>("Hedger", "Hedged reads across two clients",
+            init<const ClientWrapper&, const ClientWrapper&, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t>(
+                "Initializes with the primary and the backup clients, the latency percentile, the initial and "
+                "the minimum delays in microseconds, and the limits of the hedges and of the reads in flight",
+                args("self", "primary", "backup", "percentile", "initial_delay", "minimum_delay", "limit", "concurrency"))
+                [with_custodian_and_ward<1, 2, with_custodian_and_ward<1, 3> >()])
+
+            .def("get_multi", &HedgerWrapper::get_multi,
+                "Fetches multiple values from the primary client, or from the backup one when it's late or has failed",
+                args("self", "keys"))
+
+            .def("get_stats", &HedgerWrapper::get_stats,
+                "Fetch the hedging counters",
                 args("self"));
     }
 }}} // namespace Yandex::Memcached::Python
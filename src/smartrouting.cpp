@@ -95,4 +95,23 @@ namespace yandex { namespace helpers { namespace smartrouting {
                 interfaces.interfaces.end(),
                 hostname);
     }
+
+    unsigned long subnet(const std::string& hostname) {
+        Interfaces& interfaces = theInterfaces::Instance();
+        Endpoint endpoint(hostname);
+
+        if(endpoint.addresses.empty()) {
+            throw Exception(std::string("No addresses for hostname: ") + hostname);
+        }
+
+        const Address& address = endpoint.addresses.front();
+
+        for(Interfaces::const_iterator it = interfaces.interfaces.begin(); it != interfaces.interfaces.end(); ++it) {
+            if(is_same_subnet_address(*it, address)) {
+                return address.address & it->mask.address;
+            }
+        }
+
+        return address.address & htonl(0xffffff00);
+    }
 }}} // namespace yandex::helpers::smartrouting
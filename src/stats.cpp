@@ -0,0 +1,229 @@
+#include "stats.hpp"
+
+#include <cstdlib>
+#include <time.h>
+
+#include <boost/format.hpp>
+
+namespace yandex { namespace memcached {
+    using namespace std;
+
+    namespace {
+        typedef map<string, uint64_t> raw_t;
+
+        inline string server_name(memcached_server_instance_st instance) {
+            return (boost::format("%1%:%2%") %
+                memcached_server_name(instance) %
+                memcached_server_port(instance)).str();
+        }
+
+        // The instances passed to the callback aren't necessarily the ones of the
+        // connection, so they're told apart by their hosts and ports
+        struct sample_context {
+            map<string, size_t> positions;
+            vector<raw_t>* servers;
+        };
+
+        static memcached_return_t collector(
+                memcached_server_instance_st instance,
+                const char* key, size_t key_length,
+                const char* value, size_t value_length,
+                void* context)
+        {
+            sample_context* sample = reinterpret_cast<sample_context*>(context);
+            map<string, size_t>::const_iterator server = sample->positions.find(server_name(instance));
+
+            if(server != sample->positions.end()) {
+                (*sample->servers)[server->second][string(key, key_length)] =
+                    strtoull(string(value, value_length).c_str(), NULL, 10);
+            }
+
+            return MEMCACHED_SUCCESS;
+        }
+
+        inline uint64_t field(const raw_t& raw, const char* name) {
+            raw_t::const_iterator it = raw.find(name);
+            return it != raw.end() ? it->second : 0;
+        }
+
+        // Counters going backwards mean that the server has been restarted
+        inline double rate(uint64_t current, uint64_t previous, double elapsed) {
+            return current >= previous && elapsed > 0 ? (current - previous) / elapsed : 0.0;
+        }
+
+        inline double ratio(uint64_t part, uint64_t whole) {
+            return whole ? static_cast<double>(part) / whole : 0.0;
+        }
+
+        // Splits "<class>:<field>" off the key, skipping the prefix
+        inline bool slab_field(const string& key, size_t prefix, uint32_t& id, string& name) {
+            char* end;
+
+            if(key.length() <= prefix) {
+                return false;
+            }
+
+            id = strtoul(key.c_str() + prefix, &end, 10);
+
+            if(end == key.c_str() + prefix || *end != ':') {
+                return false;
+            }
+
+            name.assign(end + 1);
+            return true;
+        }
+
+        inline uint64_t milliseconds() {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+
+            return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+        }
+    }
+
+    stats_collector::stats_collector():
+        m_sampled(0) {}
+
+    void stats_collector::sample(memcached_st* connection) {
+        uint32_t count = memcached_server_count(connection);
+        vector<raw_t> general(count), slabs(count), items(count);
+        sample_context context;
+
+        for(uint32_t i = 0; i < count; ++i) {
+            context.positions[server_name(memcached_server_instance_by_position(connection, i))] = i;
+        }
+
+        context.servers = &general;
+
+        memcached_stat_execute(connection, NULL, collector, &context);
+
+        context.servers = &slabs;
+        memcached_stat_execute(connection, "slabs", collector, &context);
+
+        context.servers = &items;
+        memcached_stat_execute(connection, "items", collector, &context);
+
+        boost::shared_ptr<cluster_stats> current(new cluster_stats());
+        cluster_stats_ptr previous = snapshot();
+        uint64_t now = milliseconds();
+        double elapsed = previous ? (now - m_sampled) / 1000.0 : 0.0, total = 0.0;
+        uint32_t id;
+        string name;
+
+        current->sampled = time(NULL);
+        current->servers.resize(count);
+
+        for(uint32_t i = 0; i < count; ++i) {
+            server_stats& server = current->servers[i];
+            server.name = server_name(memcached_server_instance_by_position(connection, i));
+
+            server.alive = !general[i].empty();
+            server.uptime = field(general[i], "uptime");
+            server.items = field(general[i], "curr_items");
+            server.bytes = field(general[i], "bytes");
+            server.limit = field(general[i], "limit_maxbytes");
+            server.connections = field(general[i], "curr_connections");
+            server.gets = field(general[i], "cmd_get");
+            server.sets = field(general[i], "cmd_set");
+            server.hits = field(general[i], "get_hits");
+            server.misses = field(general[i], "get_misses");
+            server.evictions = field(general[i], "evictions");
+            server.bytes_read = field(general[i], "bytes_read");
+            server.bytes_written = field(general[i], "bytes_written");
+
+            for(raw_t::const_iterator it = slabs[i].begin(); it != slabs[i].end(); ++it) {
+                if(!slab_field(it->first, 0, id, name)) {
+                    continue;
+                }
+
+                slab_stats& slab = server.slabs[id];
+
+                if(name == "chunk_size") {
+                    slab.chunk_size = it->second;
+                } else if(name == "chunks_per_page") {
+                    slab.chunks_per_page = it->second;
+                } else if(name == "total_pages") {
+                    slab.total_pages = it->second;
+                } else if(name == "total_chunks") {
+                    slab.total_chunks = it->second;
+                } else if(name == "used_chunks") {
+                    slab.used_chunks = it->second;
+                } else if(name == "free_chunks") {
+                    slab.free_chunks = it->second;
+                } else if(name == "mem_requested") {
+                    slab.requested = it->second;
+                }
+            }
+
+            for(raw_t::const_iterator it = items[i].begin(); it != items[i].end(); ++it) {
+                if(it->first.compare(0, 6, "items:") || !slab_field(it->first, 6, id, name)) {
+                    continue;
+                }
+
+                slab_stats& slab = server.slabs[id];
+
+                if(name == "number") {
+                    slab.items = it->second;
+                } else if(name == "age") {
+                    slab.age = it->second;
+                } else if(name == "evicted") {
+                    slab.evicted = it->second;
+                } else if(name == "outofmemory") {
+                    slab.outofmemory = it->second;
+                }
+            }
+
+            // Only the same server, still up since the last sample, is good for the rates
+            const server_stats* before = previous && i < previous->servers.size() &&
+                previous->servers[i].name == server.name && previous->servers[i].alive &&
+                server.uptime >= previous->servers[i].uptime ? &previous->servers[i] : NULL;
+
+            for(slabs_t::iterator it = server.slabs.begin(); it != server.slabs.end(); ++it) {
+                slab_stats& slab = it->second;
+                uint64_t allocated = slab.used_chunks * slab.chunk_size;
+
+                slab.wasted = allocated > slab.requested ? allocated - slab.requested : 0;
+                slab.waste = ratio(slab.wasted, allocated);
+
+                if(before) {
+                    slabs_t::const_iterator earlier = before->slabs.find(it->first);
+
+                    if(earlier != before->slabs.end()) {
+                        slab.evictions_per_second = rate(slab.evicted, earlier->second.evicted, elapsed);
+                    }
+                }
+            }
+
+            if(before) {
+                server.gets_per_second = rate(server.gets, before->gets, elapsed);
+                server.sets_per_second = rate(server.sets, before->sets, elapsed);
+                server.evictions_per_second = rate(server.evictions, before->evictions, elapsed);
+                server.bytes_read_per_second = rate(server.bytes_read, before->bytes_read, elapsed);
+                server.bytes_written_per_second = rate(server.bytes_written, before->bytes_written, elapsed);
+
+                uint64_t hits = server.hits >= before->hits ? server.hits - before->hits : 0;
+                uint64_t misses = server.misses >= before->misses ? server.misses - before->misses : 0;
+
+                server.hit_ratio = ratio(hits, hits + misses);
+            } else {
+                server.hit_ratio = ratio(server.hits, server.hits + server.misses);
+            }
+
+            total += server.gets_per_second + server.sets_per_second;
+        }
+
+        for(vector<server_stats>::iterator it = current->servers.begin(); it != current->servers.end(); ++it) {
+            it->share = total > 0 ? (it->gets_per_second + it->sets_per_second) / total : 0.0;
+        }
+
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        m_snapshot = current;
+        m_sampled = now;
+    }
+
+    cluster_stats_ptr stats_collector::snapshot() const {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_snapshot;
+    }
+}}
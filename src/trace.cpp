@@ -0,0 +1,209 @@
+#include "trace.hpp"
+#include "keys.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <time.h>
+
+#include <boost/static_assert.hpp>
+
+namespace yandex { namespace memcached {
+    using namespace std;
+
+    // The layout is the file format, so it mustn't depend on the padding
+    BOOST_STATIC_ASSERT(sizeof(trace_record) == 40);
+    BOOST_STATIC_ASSERT(sizeof(trace_header) == 16);
+
+    namespace {
+        // The writer sleeps for this long when the ring is empty
+        const uint32_t idle_interval = 10;
+        const size_t write_batch = 1024;
+    }
+
+    tracer::tracer():
+        m_mask(0),
+        m_tail(0),
+        m_head(0),
+        m_enabled(false),
+        m_calls(0),
+        m_dropped(0),
+        m_file(NULL) {}
+
+    tracer::~tracer() {
+        stop();
+    }
+
+    bool tracer::start(const string& path, uint32_t capacity) {
+        stop();
+
+        if(!m_cells) {
+            // Rounded up to a power of two, so that the positions are masked
+            uint64_t size = 1;
+
+            while(size < std::max<uint32_t>(capacity, 2)) {
+                size <<= 1;
+            }
+
+            m_cells.reset(new cell[size]);
+            m_mask = size - 1;
+
+            for(uint64_t i = 0; i < size; ++i) {
+                m_cells[i].sequence = i;
+            }
+        }
+
+        m_file = fopen(path.c_str(), "wb");
+
+        if(!m_file) {
+            return false;
+        }
+
+        trace_header header;
+
+        memcpy(header.magic, trace_magic, sizeof(header.magic));
+        header.version = trace_version;
+        header.record_size = sizeof(trace_record);
+
+        fwrite(&header, sizeof(header), 1, m_file);
+
+        m_writer.reset(new boost::thread(&tracer::drain, this));
+        __sync_synchronize();
+        m_enabled = true;
+
+        return true;
+    }
+
+    void tracer::stop() {
+        if(!m_writer) {
+            return;
+        }
+
+        m_enabled = false;
+        __sync_synchronize();
+
+        // The writer empties the ring before exiting
+        m_writer->interrupt();
+        m_writer->join();
+        m_writer.reset();
+
+        fclose(m_file);
+        m_file = NULL;
+    }
+
+    trace_call tracer::begin() {
+        trace_call call;
+
+        if(!m_enabled) {
+            return call;
+        }
+
+        call.id = __sync_add_and_fetch(&m_calls, 1);
+        call.start = now();
+
+        return call;
+    }
+
+    void tracer::record(const trace_call& call, trace_op op, const string& key, size_t value_length,
+        size_t inflated_length, uint8_t flags, memcached_return_t rc)
+    {
+        uint64_t position = m_tail, finish = now(), h1, h2;
+        cell* target;
+
+        // A bounded multi-producer queue: a cell is free for the position when its
+        // sequence matches it, and the producers race for the position itself
+        while(true) {
+            target = &m_cells[position & m_mask];
+            int64_t difference = static_cast<int64_t>(target->sequence - position);
+
+            if(difference == 0) {
+                uint64_t previous = __sync_val_compare_and_swap(&m_tail, position, position + 1);
+
+                if(previous == position) {
+                    break;
+                }
+
+                position = previous;
+            } else if(difference < 0) {
+                __sync_fetch_and_add(&m_dropped, 1);
+                return;
+            } else {
+                position = m_tail;
+            }
+        }
+
+        detail::murmur3(key.data(), key.length(), h1, h2);
+
+        trace_record& r = target->record;
+
+        r.timestamp = call.start;
+        r.key_hash = h1;
+        r.call = call.id;
+        r.value_length = std::min<size_t>(value_length, numeric_limits<uint32_t>::max());
+        r.inflated_length = std::min<size_t>(inflated_length, numeric_limits<uint32_t>::max());
+        r.latency = std::min<uint64_t>(finish > call.start ? finish - call.start : 0, numeric_limits<uint32_t>::max());
+        r.key_length = std::min<size_t>(key.length(), numeric_limits<uint16_t>::max());
+        r.result = rc;
+        r.op = op;
+        r.flags = flags;
+        memset(r.reserved, 0, sizeof(r.reserved));
+
+        __sync_synchronize();
+        target->sequence = position + 1;
+    }
+
+    bool tracer::pop(trace_record& record) {
+        cell& source = m_cells[m_head & m_mask];
+
+        if(source.sequence != m_head + 1) {
+            return false;
+        }
+
+        __sync_synchronize();
+        record = source.record;
+        __sync_synchronize();
+
+        source.sequence = m_head + m_mask + 1;
+        m_head++;
+
+        return true;
+    }
+
+    void tracer::drain() {
+        trace_record batch[write_batch];
+        bool stopping = false;
+
+        while(true) {
+            size_t count = 0;
+
+            while(count < write_batch && pop(batch[count])) {
+                count++;
+            }
+
+            if(count) {
+                fwrite(batch, sizeof(trace_record), count, m_file);
+                continue;
+            }
+
+            if(stopping) {
+                break;
+            }
+
+            try {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(idle_interval));
+            } catch(const boost::thread_interrupted&) {
+                // One last pass for whatever has been pushed by now
+                stopping = true;
+            }
+        }
+
+        fflush(m_file);
+    }
+
+    uint64_t tracer::now() {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+}}
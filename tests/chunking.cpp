@@ -0,0 +1,78 @@
+#include <boost/test/unit_test.hpp>
+
+#include "chunking.hpp"
+
+using namespace yandex::helpers;
+
+BOOST_AUTO_TEST_SUITE(chunking)
+
+BOOST_AUTO_TEST_CASE(round_trip) {
+    std::string value(1000, 'x');
+    manifest original(value.data(), value.length(), 300, 42), parsed;
+    std::string body = original.serialize();
+    size_t size = manifest::size;
+
+    BOOST_REQUIRE_EQUAL(body.length(), size);
+    BOOST_REQUIRE(parsed.parse(body.data(), body.length()));
+
+    BOOST_CHECK_EQUAL(parsed.count(), 4u);
+    BOOST_CHECK_EQUAL(parsed.length(), 1000u);
+    BOOST_CHECK_EQUAL(parsed.offset(3), 900u);
+    BOOST_CHECK_EQUAL(parsed.length(3), 100u);
+    BOOST_CHECK(parsed.verify(value.data(), value.length()));
+
+    // The generation takes part in the chunk keys
+    std::string expected, actual;
+
+    original.key("key", 1, expected);
+    parsed.key("key", 1, actual);
+
+    BOOST_CHECK_EQUAL(actual, expected);
+}
+
+BOOST_AUTO_TEST_CASE(checksum_rejection) {
+    std::string value(1000, 'x');
+    manifest m(value.data(), value.length(), 300, 42);
+
+    value[500] = 'y';
+    BOOST_CHECK(!m.verify(value.data(), value.length()));
+
+    // A value of the wrong length is never checked any further
+    BOOST_CHECK(!m.verify(value.data(), value.length() - 1));
+}
+
+BOOST_AUTO_TEST_CASE(malformed_manifests) {
+    std::string value(1000, 'x');
+    manifest m, original(value.data(), value.length(), 300, 42);
+    std::string body = original.serialize();
+
+    BOOST_CHECK(!m.parse(body.data(), body.length() - 1));
+
+    std::string magic(body);
+    magic[0] ^= 0xff;
+    BOOST_CHECK(!m.parse(magic.data(), magic.length()));
+
+    // The count has to match the length and the chunk size
+    std::string count(body);
+    count[4] ^= 0x01;
+    BOOST_CHECK(!m.parse(count.data(), count.length()));
+}
+
+BOOST_AUTO_TEST_CASE(chunk_keys) {
+    std::string value(1000, 'x');
+    manifest first(value.data(), value.length(), 300, 1), second(value.data(), value.length(), 300, 2);
+    std::string a, b, c;
+
+    first.key("key", 0, a);
+    first.key("key", 1, b);
+    second.key("key", 0, c);
+
+    BOOST_CHECK(a != b);
+    BOOST_CHECK(a != c);
+
+    // Long keys are digested down to a legal length
+    first.key(std::string(1000, 'k'), 0, a);
+    BOOST_CHECK(a.length() < 250);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,130 @@
+#include <boost/test/unit_test.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "hotkeys.hpp"
+
+using namespace yandex::memcached;
+
+BOOST_AUTO_TEST_SUITE(hotkeys)
+
+namespace {
+    // A snapshot path of its own for every test, removed afterwards
+    struct snapshot {
+        snapshot() {
+            char name[] = "/tmp/hotkeys.XXXXXX";
+            int fd = mkstemp(name);
+
+            close(fd);
+            path = name;
+        }
+
+        ~snapshot() {
+            unlink(path.c_str());
+        }
+
+        long size() const {
+            FILE* file = fopen(path.c_str(), "rb");
+            long result = -1;
+
+            if(file && fseek(file, 0, SEEK_END) == 0) {
+                result = ftell(file);
+            }
+
+            if(file) {
+                fclose(file);
+            }
+
+            return result;
+        }
+
+        std::string path;
+    };
+
+    void fill(hot_keys& counts) {
+        counts.reset(16, 1);
+
+        for(int i = 0; i < 3; ++i) {
+            counts.touch("hottest");
+        }
+
+        for(int i = 0; i < 2; ++i) {
+            counts.touch("warm");
+        }
+
+        counts.touch("cold");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(round_trip) {
+    hot_keys counts;
+    snapshot file;
+    std::vector<std::string> keys;
+
+    fill(counts);
+
+    BOOST_REQUIRE(counts.save(file.path));
+    BOOST_REQUIRE(hot_keys::load(file.path, keys));
+
+    BOOST_REQUIRE_EQUAL(keys.size(), 3u);
+    BOOST_CHECK_EQUAL(keys[0], "hottest");
+    BOOST_CHECK_EQUAL(keys[1], "warm");
+    BOOST_CHECK_EQUAL(keys[2], "cold");
+}
+
+BOOST_AUTO_TEST_CASE(truncated_snapshot) {
+    hot_keys counts;
+    snapshot file;
+    std::vector<std::string> keys;
+
+    fill(counts);
+    BOOST_REQUIRE(counts.save(file.path));
+
+    // Cut in the middle of the last key, and then of its length
+    long size = file.size();
+
+    BOOST_REQUIRE_EQUAL(truncate(file.path.c_str(), size - 2), 0);
+    BOOST_REQUIRE(hot_keys::load(file.path, keys));
+    BOOST_REQUIRE_EQUAL(keys.size(), 2u);
+    BOOST_CHECK_EQUAL(keys[1], "warm");
+
+    BOOST_REQUIRE_EQUAL(truncate(file.path.c_str(), size - 5), 0);
+    BOOST_REQUIRE(hot_keys::load(file.path, keys));
+    BOOST_CHECK_EQUAL(keys.size(), 2u);
+
+    // Not even the header is left
+    BOOST_REQUIRE_EQUAL(truncate(file.path.c_str(), sizeof(hot_keys_header) - 1), 0);
+    BOOST_CHECK(!hot_keys::load(file.path, keys));
+    BOOST_CHECK(keys.empty());
+}
+
+BOOST_AUTO_TEST_CASE(invalid_snapshot) {
+    snapshot file;
+    std::vector<std::string> keys;
+    hot_keys_header header;
+
+    memcpy(header.magic, hot_keys_magic, sizeof(header.magic));
+    header.version = hot_keys_version + 1;
+    header.count = 0;
+
+    FILE* output = fopen(file.path.c_str(), "wb");
+    BOOST_REQUIRE(output);
+    BOOST_REQUIRE_EQUAL(fwrite(&header, sizeof(header), 1, output), 1u);
+    fclose(output);
+
+    BOOST_CHECK(!hot_keys::load(file.path, keys));
+    BOOST_CHECK(!hot_keys::load(file.path + ".missing", keys));
+}
+
+BOOST_AUTO_TEST_CASE(disabled) {
+    hot_keys counts;
+
+    counts.touch("key");
+    BOOST_CHECK(counts.top(10).empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
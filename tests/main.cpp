@@ -0,0 +1,3 @@
+// The test runner, built along with the test suites by 'scons test'
+#define BOOST_TEST_MODULE yandex-memcached
+#include <boost/test/included/unit_test.hpp>
@@ -0,0 +1,78 @@
+#include <boost/test/unit_test.hpp>
+
+#include "policy.hpp"
+
+using namespace yandex::memcached;
+
+BOOST_AUTO_TEST_SUITE(policies)
+
+namespace {
+    policy_options_t options() {
+        policy_options_t result;
+
+        result["sessions:"]["expiration-minimum"] = 600;
+        result["sessions:"]["expiration-maximum"] = 600;
+        result["sessions:long:"]["expiration-minimum"] = 3600;
+        result["sessions:long:"]["expiration-maximum"] = 3600;
+        result["pages:"]["replication-factor"] = 3;
+        result["pages:"]["compression-threshold"] = 1024;
+
+        return result;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(longest_prefix) {
+    policy_table table;
+    policy defaults;
+
+    defaults.expiration_minimum = defaults.expiration_maximum = 60;
+    table.reset(defaults, options());
+
+    BOOST_CHECK_EQUAL(table.resolve("sessions:1").expiration_minimum, 600);
+    BOOST_CHECK_EQUAL(table.resolve("sessions:long:1").expiration_minimum, 3600);
+    BOOST_CHECK_EQUAL(table.resolve("sessions:lo").expiration_minimum, 600);
+    BOOST_CHECK_EQUAL(table.resolve("pages:1").replication_factor, 3u);
+    BOOST_CHECK_EQUAL(table.resolve("pages:1").compression_threshold, 1024u);
+}
+
+BOOST_AUTO_TEST_CASE(defaults) {
+    policy_table table;
+    policy defaults;
+
+    defaults.expiration_minimum = defaults.expiration_maximum = 60;
+    table.reset(defaults, options());
+
+    // Neither the keys shorter than the prefixes nor the ones merely sharing a part of them match
+    BOOST_CHECK_EQUAL(table.resolve("").expiration_minimum, 60);
+    BOOST_CHECK_EQUAL(table.resolve("sessions").expiration_minimum, 60);
+    BOOST_CHECK_EQUAL(table.resolve("sessionz:1").expiration_minimum, 60);
+    BOOST_CHECK_EQUAL(table.resolve("other").replication_factor, 1u);
+
+    // The settings which aren't given follow the defaults
+    BOOST_CHECK_EQUAL(table.resolve("pages:1").expiration_minimum, 60);
+}
+
+BOOST_AUTO_TEST_CASE(replication) {
+    policy_table table;
+
+    table.reset(policy(), options());
+    BOOST_CHECK_EQUAL(table.replication(), 3u);
+
+    table.reset(policy(), policy_options_t());
+    BOOST_CHECK_EQUAL(table.replication(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(settings) {
+    policy rules;
+
+    BOOST_CHECK(!rules.set("unknown", 1));
+
+    // A factor of zero would drop the primary copy as well
+    BOOST_CHECK(rules.set("replication-factor", 0));
+    BOOST_CHECK_EQUAL(rules.replication_factor, 1u);
+
+    // Explicit expirations are never replaced
+    BOOST_CHECK_EQUAL(rules.expiration(5), 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,393 @@
+// Predicts how a change of the server list or of the hashing options redistributes
+// the keyspace, using the hashing of the Client itself:
+//
+//   memcached-rebalance [-o|-b|-a name=value]... [-t threads] [-s] before after keys
+//
+// The server lists are comma-separated 'host:port[:weight]' entries, and the keys
+// file holds a key per line, followed by the value size when -s is given. The options
+// are the ones of Client::configure(), applied to both configurations with -o, and
+// to the one before or after the change only with -b and -a respectively
+
+#include "cache.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/thread/thread.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+
+#include <log4cxx/helpers/loglog.h>
+
+using namespace std;
+using namespace yandex::memcached;
+
+namespace {
+    // Keys are located in batches, so that every batch takes a single connection
+    const size_t batch_size = 4096;
+
+    struct tally {
+        tally(size_t before_count, size_t after_count):
+            before_keys(before_count),
+            before_weight(before_count),
+            after_keys(after_count),
+            after_weight(after_count),
+            keys(0),
+            weight(0),
+            moved_keys(0),
+            moved_weight(0),
+            failed(false) {}
+
+        vector<uint64_t> before_keys, before_weight, after_keys, after_weight;
+        uint64_t keys, weight, moved_keys, moved_weight;
+        bool failed;
+    };
+
+    struct worker {
+        worker(Client& before_, Client& after_, const vector<int>& mapping_, bool sized_,
+            const char* begin_, const char* end_, tally& result_):
+            before(before_),
+            after(after_),
+            mapping(mapping_),
+            sized(sized_),
+            begin(begin_),
+            end(end_),
+            result(result_) {}
+
+        void operator()() {
+            cache_vector_t keys(batch_size);
+            vector<uint64_t> weights(batch_size);
+            vector<uint32_t> located_before, located_after;
+            size_t count = 0;
+
+            for(const char* line = begin; line < end; ) {
+                const char* eol = static_cast<const char*>(memchr(line, '\n', end - line));
+                const char* stop = eol ? eol : end;
+                const char* separator = stop;
+
+                if(stop > line && stop[-1] == '\r') {
+                    --stop;
+                }
+
+                if(sized) {
+                    separator = find_if(line, stop, is_separator);
+                }
+
+                if(separator > line) {
+                    keys[count].assign(line, separator);
+                    weights[count] = sized ? number(separator, stop) : 1;
+
+                    if(++count == batch_size) {
+                        if(!account(keys, weights, count, located_before, located_after)) {
+                            return;
+                        }
+
+                        count = 0;
+                    }
+                }
+
+                line = eol ? eol + 1 : end;
+            }
+
+            if(count) {
+                keys.resize(count);
+                account(keys, weights, count, located_before, located_after);
+            }
+        }
+
+        bool account(const cache_vector_t& keys, const vector<uint64_t>& weights, size_t count,
+            vector<uint32_t>& located_before, vector<uint32_t>& located_after)
+        {
+            before.locate(keys, located_before);
+            after.locate(keys, located_after);
+
+            if(located_before.size() != keys.size() || located_after.size() != keys.size()) {
+                result.failed = true;
+                return false;
+            }
+
+            for(size_t i = 0; i < count; ++i) {
+                uint32_t from = located_before[i], to = located_after[i];
+
+                result.before_keys[from]++;
+                result.before_weight[from] += weights[i];
+                result.after_keys[to]++;
+                result.after_weight[to] += weights[i];
+
+                result.keys++;
+                result.weight += weights[i];
+
+                if(mapping[from] != static_cast<int>(to)) {
+                    result.moved_keys++;
+                    result.moved_weight += weights[i];
+                }
+            }
+
+            return true;
+        }
+
+        // The mapping might end right after the number, so it's copied out first
+        static uint64_t number(const char* begin, const char* end) {
+            char buffer[32];
+            size_t length = min<size_t>(end - begin, sizeof(buffer) - 1);
+
+            memcpy(buffer, begin, length);
+            buffer[length] = 0;
+
+            return strtoull(buffer, NULL, 10);
+        }
+
+        static bool is_separator(char c) {
+            return c == ' ' || c == '\t';
+        }
+
+        Client& before;
+        Client& after;
+        const vector<int>& mapping;
+        bool sized;
+        const char* begin;
+        const char* end;
+        tally& result;
+    };
+
+    // The ratio of the largest load to the mean one, and the coefficient of variation
+    void skew(const vector<uint64_t>& load, double& peak, double& variation) {
+        double mean = 0.0, deviation = 0.0;
+
+        peak = variation = 0.0;
+
+        if(load.empty()) {
+            return;
+        }
+
+        for(size_t i = 0; i < load.size(); ++i) {
+            mean += load[i];
+        }
+
+        mean /= load.size();
+
+        if(mean == 0.0) {
+            return;
+        }
+
+        for(size_t i = 0; i < load.size(); ++i) {
+            deviation += (load[i] - mean) * (load[i] - mean);
+            peak = max<double>(peak, load[i]);
+        }
+
+        peak /= mean;
+        variation = sqrt(deviation / load.size()) / mean;
+    }
+
+    inline double percent(uint64_t part, uint64_t whole) {
+        return whole ? part * 100.0 / whole : 0.0;
+    }
+
+    void usage(const char* name) {
+        cerr << "usage: " << name << " [-o|-b|-a name=value]... [-t threads] [-s] before-servers after-servers keys-file"
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    void option(map<string, uint64_t>& config, const char* arg, const char* name) {
+        const char* value = strchr(arg, '=');
+
+        if(!value) {
+            usage(name);
+        }
+
+        config[string(arg, value)] = strtoull(value + 1, NULL, 10);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    map<string, uint64_t> before_config, after_config;
+    uint32_t threads = max(boost::thread::hardware_concurrency(), 1u);
+    bool sized = false;
+    int opt;
+
+    while((opt = getopt(argc, argv, "o:b:a:t:s")) != -1) {
+        switch(opt) {
+            case 'o':
+                option(before_config, optarg, argv[0]);
+                option(after_config, optarg, argv[0]);
+                break;
+            case 'b':
+                option(before_config, optarg, argv[0]);
+                break;
+            case 'a':
+                option(after_config, optarg, argv[0]);
+                break;
+            case 't':
+                threads = max(atoi(optarg), 1);
+                break;
+            case 's':
+                sized = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(argc - optind != 3) {
+        usage(argv[0]);
+    }
+
+    log4cxx::helpers::LogLog::setQuietMode(true);
+
+    // Every thread holds a connection of each client while locating a batch
+    before_config["pool-size"] = after_config["pool-size"] = threads * 2;
+    before_config["pool-blocking"] = after_config["pool-blocking"] = 1;
+
+    vector<string> before_servers, after_servers;
+    boost::split(before_servers, argv[optind], boost::is_any_of(","));
+    boost::split(after_servers, argv[optind + 1], boost::is_any_of(","));
+
+    Client before(before_servers), after(after_servers);
+
+    before.configure(before_config);
+    after.configure(after_config);
+
+    vector<string> before_names = before.get_servers(), after_names = after.get_servers();
+
+    if(before_names.empty() || after_names.empty()) {
+        cerr << "empty server list" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // A key stays in place when it's hashed to the same server after the change
+    vector<int> mapping(before_names.size(), -1);
+
+    for(size_t i = 0; i < before_names.size(); ++i) {
+        vector<string>::const_iterator it = find(after_names.begin(), after_names.end(), before_names[i]);
+
+        if(it != after_names.end()) {
+            mapping[i] = it - after_names.begin();
+        }
+    }
+
+    // The keys file is mapped and split into the ranges of whole lines, one per thread
+    int fd = open(argv[optind + 2], O_RDONLY);
+    struct stat st;
+
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        perror(argv[optind + 2]);
+        return EXIT_FAILURE;
+    }
+
+    const char* data = NULL;
+
+    if(st.st_size > 0) {
+        void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(mapped == MAP_FAILED) {
+            perror(argv[optind + 2]);
+            return EXIT_FAILURE;
+        }
+
+        data = static_cast<const char*>(mapped);
+        madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+    }
+
+    const char* end = data + st.st_size;
+    vector<tally> tallies(threads, tally(before_names.size(), after_names.size()));
+    boost::thread_group group;
+    const char* begin = data;
+
+    for(uint32_t i = 0; i < threads && begin < end; ++i) {
+        const char* stop = i == threads - 1 ? end : data + st.st_size / threads * (i + 1);
+
+        if(stop <= begin) {
+            stop = begin + 1;
+        }
+
+        while(stop < end && stop[-1] != '\n') {
+            ++stop;
+        }
+
+        group.create_thread(worker(before, after, mapping, sized, begin, stop, tallies[i]));
+        begin = stop;
+    }
+
+    group.join_all();
+
+    tally total(before_names.size(), after_names.size());
+
+    for(vector<tally>::const_iterator it = tallies.begin(); it != tallies.end(); ++it) {
+        if(it->failed) {
+            cerr << "failed to get a connection to locate the keys" << endl;
+            return EXIT_FAILURE;
+        }
+
+        for(size_t i = 0; i < before_names.size(); ++i) {
+            total.before_keys[i] += it->before_keys[i];
+            total.before_weight[i] += it->before_weight[i];
+        }
+
+        for(size_t i = 0; i < after_names.size(); ++i) {
+            total.after_keys[i] += it->after_keys[i];
+            total.after_weight[i] += it->after_weight[i];
+        }
+
+        total.keys += it->keys;
+        total.weight += it->weight;
+        total.moved_keys += it->moved_keys;
+        total.moved_weight += it->moved_weight;
+    }
+
+    // Servers in the order of the list before the change, followed by the new ones
+    vector<string> names(before_names);
+
+    for(vector<string>::const_iterator it = after_names.begin(); it != after_names.end(); ++it) {
+        if(find(names.begin(), names.end(), *it) == names.end()) {
+            names.push_back(*it);
+        }
+    }
+
+    const vector<uint64_t>& before_load = sized ? total.before_weight : total.before_keys;
+    const vector<uint64_t>& after_load = sized ? total.after_weight : total.after_keys;
+
+    printf("%-32s %14s %8s %14s %8s\n", "server", "before", "share", "after", "share");
+
+    for(vector<string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+        vector<string>::const_iterator was = find(before_names.begin(), before_names.end(), *it);
+        vector<string>::const_iterator is = find(after_names.begin(), after_names.end(), *it);
+        uint64_t from = was != before_names.end() ? before_load[was - before_names.begin()] : 0;
+        uint64_t to = is != after_names.end() ? after_load[is - after_names.begin()] : 0;
+
+        printf("%-32s %14llu %7.2f%% %14llu %7.2f%%\n", it->c_str(),
+            static_cast<unsigned long long>(from), percent(from, sized ? total.weight : total.keys),
+            static_cast<unsigned long long>(to), percent(to, sized ? total.weight : total.keys));
+    }
+
+    double before_peak, before_variation, after_peak, after_variation;
+
+    skew(before_load, before_peak, before_variation);
+    skew(after_load, after_peak, after_variation);
+
+    printf("\n%-32s %14.3f %23.3f\n", "skew (max / mean)", before_peak, after_peak);
+    printf("%-32s %14.3f %23.3f\n", "coefficient of variation", before_variation, after_variation);
+
+    printf("\nkeys: %llu, moved: %llu (%.2f%%)\n",
+        static_cast<unsigned long long>(total.keys),
+        static_cast<unsigned long long>(total.moved_keys),
+        percent(total.moved_keys, total.keys));
+
+    if(sized) {
+        printf("bytes: %llu, moved: %llu (%.2f%%)\n",
+            static_cast<unsigned long long>(total.weight),
+            static_cast<unsigned long long>(total.moved_weight),
+            percent(total.moved_weight, total.weight));
+    }
+
+    return EXIT_SUCCESS;
+}
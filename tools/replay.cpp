@@ -0,0 +1,430 @@
+// Replays a trace recorded with Client::start_trace() against a set of servers,
+// keeping the original pacing and mix of the operations:
+//
+//   memcached-replay [-o name=value]... [-c concurrency] [-x speed] servers trace
+//
+// The server list is comma-separated 'host:port[:weight]' entries, and the options are
+// the ones of Client::configure(). The speed multiplies the original rate. As the trace
+// only holds the hashes of the keys, the keys are synthesized from them, keeping their
+// lengths, and the values are filler data of the recorded sizes, which compresses down
+// to about the recorded wire size
+//
+// Every call is due at its original offset from the start of the trace, divided by the
+// speed, and the lag is how late it has actually been started
+
+#include "cache.hpp"
+#include "trace.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <limits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+
+#include <log4cxx/helpers/loglog.h>
+
+using namespace std;
+using namespace yandex::memcached;
+
+namespace {
+    const size_t op_count = trace_remove + 1;
+
+    // Random filler shared by the incompressible values, which are slices of it
+    const size_t filler_size = 1 << 20;
+
+    const char* op_names[op_count] = {
+        "", "get", "get_multi", "set", "add", "replace", "append", "prepend",
+        "cas", "incr", "decr", "touch", "remove"
+    };
+
+    // Records of a call, which are a range of the sorted trace
+    struct call_range {
+        const trace_record* begin;
+        const trace_record* end;
+        uint64_t due;
+    };
+
+    bool by_start(const trace_record& lhs, const trace_record& rhs) {
+        return lhs.timestamp < rhs.timestamp || (lhs.timestamp == rhs.timestamp && lhs.call < rhs.call);
+    }
+
+    class call_queue: private boost::noncopyable {
+        public:
+            call_queue(size_t limit):
+                m_limit(limit),
+                m_closed(false) {}
+
+            void push(const call_range& range) {
+                boost::mutex::scoped_lock lock(m_mutex);
+
+                while(m_calls.size() >= m_limit) {
+                    m_room.wait(lock);
+                }
+
+                m_calls.push_back(range);
+                m_ready.notify_one();
+            }
+
+            bool pop(call_range& range) {
+                boost::mutex::scoped_lock lock(m_mutex);
+
+                while(m_calls.empty() && !m_closed) {
+                    m_ready.wait(lock);
+                }
+
+                if(m_calls.empty()) {
+                    return false;
+                }
+
+                range = m_calls.front();
+                m_calls.pop_front();
+                m_room.notify_one();
+
+                return true;
+            }
+
+            void close() {
+                boost::mutex::scoped_lock lock(m_mutex);
+
+                m_closed = true;
+                m_ready.notify_all();
+            }
+
+        private:
+            std::deque<call_range> m_calls;
+            size_t m_limit;
+            bool m_closed;
+
+            boost::mutex m_mutex;
+            boost::condition_variable m_ready, m_room;
+    };
+
+    struct tally {
+        tally():
+            latencies(op_count),
+            failures(op_count),
+            lags() {}
+
+        vector<vector<uint32_t> > latencies;
+        vector<uint64_t> failures;
+        vector<uint32_t> lags;
+    };
+
+    struct worker {
+        worker(Client& client_, call_queue& queue_, const string& filler_, tally& result_):
+            client(client_),
+            queue(queue_),
+            filler(filler_),
+            result(result_) {}
+
+        void operator()() {
+            call_range range;
+
+            while(queue.pop(range)) {
+                uint64_t started = tracer::now();
+
+                result.lags.push_back(clamp(started > range.due ? started - range.due : 0));
+
+                bool succeeded = execute(range);
+                uint8_t op = range.begin->op;
+
+                result.latencies[op].push_back(clamp(tracer::now() - started));
+
+                if(!succeeded) {
+                    result.failures[op]++;
+                }
+            }
+        }
+
+        // Returns false for the failures and the misses alike
+        bool execute(const call_range& range) {
+            const trace_record& r = *range.begin;
+            string key = synthesize(r);
+            uint64_t counter;
+
+            switch(r.op) {
+                case trace_get:
+                    return !client.get(key).empty();
+                case trace_get_multi: {
+                    cache_vector_t keys;
+
+                    for(const trace_record* it = range.begin; it != range.end; ++it) {
+                        keys.push_back(synthesize(*it));
+                    }
+
+                    return !client.get_multi(keys).empty();
+                }
+                case trace_set:
+                case trace_cas:
+                    return client.set(key, value(r));
+                case trace_add:
+                    return client.add(key, value(r));
+                case trace_replace:
+                    return client.replace(key, value(r));
+                case trace_append:
+                    return client.append(key, value(r));
+                case trace_prepend:
+                    return client.prepend(key, value(r));
+                case trace_incr:
+                    return client.incr(key, 1, counter);
+                case trace_decr:
+                    return client.decr(key, 1, counter);
+                case trace_touch:
+                    return client.touch(key);
+                case trace_remove:
+                    return client.remove(key);
+            }
+
+            return false;
+        }
+
+        static string synthesize(const trace_record& r) {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "replay:%016llx", static_cast<unsigned long long>(r.key_hash));
+
+            string key(buffer);
+
+            if(r.key_length > key.length()) {
+                key.resize(min<size_t>(r.key_length, MEMCACHED_MAX_KEY - 1), '_');
+            }
+
+            return key;
+        }
+
+        // Random data of the wire length padded with a run up to the inflated one, so that the
+        // compressed values are compressed again to about the same size, and the rest aren't
+        string value(const trace_record& r) const {
+            size_t length = max<size_t>(r.value_length, 1);
+            size_t inflated = max<size_t>(r.inflated_length, length);
+
+            string result;
+            result.reserve(inflated);
+
+            for(size_t offset = r.key_hash % filler.size(); result.size() < length; offset = 0) {
+                result.append(filler, offset, length - result.size());
+            }
+
+            result.resize(inflated, 'x');
+            return result;
+        }
+
+        static uint32_t clamp(uint64_t value) {
+            return static_cast<uint32_t>(min<uint64_t>(value, numeric_limits<uint32_t>::max()));
+        }
+
+        Client& client;
+        call_queue& queue;
+        const string& filler;
+        tally& result;
+    };
+
+    uint32_t percentile(const vector<uint32_t>& sorted, double rank) {
+        if(sorted.empty()) {
+            return 0;
+        }
+
+        return sorted[min<size_t>(sorted.size() * rank, sorted.size() - 1)];
+    }
+
+    void usage(const char* name) {
+        cerr << "usage: " << name << " [-o name=value]... [-c concurrency] [-x speed] servers trace-file" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    void option(map<string, uint64_t>& config, const char* arg, const char* name) {
+        const char* value = strchr(arg, '=');
+
+        if(!value) {
+            usage(name);
+        }
+
+        config[string(arg, value)] = strtoull(value + 1, NULL, 10);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    map<string, uint64_t> config;
+    uint32_t concurrency = 16;
+    double speed = 1.0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "o:c:x:")) != -1) {
+        switch(opt) {
+            case 'o':
+                option(config, optarg, argv[0]);
+                break;
+            case 'c':
+                concurrency = max(atoi(optarg), 1);
+                break;
+            case 'x':
+                speed = atof(optarg);
+
+                if(speed <= 0.0) {
+                    usage(argv[0]);
+                }
+
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(argc - optind != 2) {
+        usage(argv[0]);
+    }
+
+    log4cxx::helpers::LogLog::setQuietMode(true);
+
+    int fd = open(argv[optind + 1], O_RDONLY);
+    struct stat st;
+
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        perror(argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    if(static_cast<size_t>(st.st_size) < sizeof(trace_header)) {
+        cerr << "not a trace file" << endl;
+        return EXIT_FAILURE;
+    }
+
+    void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if(mapped == MAP_FAILED) {
+        perror(argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    const trace_header* header = static_cast<const trace_header*>(mapped);
+
+    if(memcmp(header->magic, trace_magic, sizeof(header->magic)) != 0 ||
+        header->version != trace_version || header->record_size != sizeof(trace_record))
+    {
+        cerr << "not a trace file, or of an unsupported version" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // The records are written in the order of completion, so they are sorted by
+    // the start of the call, keeping the records of a call together
+    const trace_record* first = reinterpret_cast<const trace_record*>(header + 1);
+    vector<trace_record> records(first, first + (st.st_size - sizeof(trace_header)) / sizeof(trace_record));
+
+    munmap(mapped, st.st_size);
+    close(fd);
+
+    stable_sort(records.begin(), records.end(), by_start);
+
+    vector<call_range> calls;
+
+    for(vector<trace_record>::const_iterator it = records.begin(); it != records.end(); ) {
+        vector<trace_record>::const_iterator end = it + 1;
+
+        while(end != records.end() && end->call == it->call && end->timestamp == it->timestamp) {
+            ++end;
+        }
+
+        if(it->op > 0 && it->op < op_count) {
+            call_range range = { &*it, &*it + (end - it), 0 };
+            calls.push_back(range);
+        }
+
+        it = end;
+    }
+
+    if(calls.empty()) {
+        cerr << "empty trace" << endl;
+        return EXIT_FAILURE;
+    }
+
+    config["pool-size"] = concurrency;
+    config["pool-blocking"] = 1;
+
+    vector<string> servers;
+    boost::split(servers, argv[optind], boost::is_any_of(","));
+
+    Client client(servers);
+    client.configure(config);
+
+    string filler(filler_size, 0);
+
+    for(size_t i = 0; i < filler.size(); ++i) {
+        filler[i] = static_cast<char>(rand());
+    }
+
+    call_queue queue(concurrency * 64);
+    vector<tally> tallies(concurrency);
+    boost::thread_group group;
+
+    for(uint32_t i = 0; i < concurrency; ++i) {
+        group.create_thread(worker(client, queue, filler, tallies[i]));
+    }
+
+    uint64_t origin = calls.front().begin->timestamp, started = tracer::now();
+
+    for(vector<call_range>::iterator it = calls.begin(); it != calls.end(); ++it) {
+        it->due = started + static_cast<uint64_t>((it->begin->timestamp - origin) / speed);
+
+        uint64_t now = tracer::now();
+
+        if(it->due > now) {
+            boost::this_thread::sleep(boost::posix_time::microseconds(it->due - now));
+        }
+
+        queue.push(*it);
+    }
+
+    queue.close();
+    group.join_all();
+
+    double elapsed = (tracer::now() - started) / 1e6;
+    tally total;
+
+    for(vector<tally>::const_iterator it = tallies.begin(); it != tallies.end(); ++it) {
+        for(size_t op = 0; op < op_count; ++op) {
+            total.latencies[op].insert(total.latencies[op].end(), it->latencies[op].begin(), it->latencies[op].end());
+            total.failures[op] += it->failures[op];
+        }
+
+        total.lags.insert(total.lags.end(), it->lags.begin(), it->lags.end());
+    }
+
+    printf("%-10s %10s %10s %8s %10s %10s %10s %10s\n",
+        "operation", "calls", "rate", "missed", "p50 us", "p90 us", "p99 us", "max us");
+
+    for(size_t op = 1; op < op_count; ++op) {
+        vector<uint32_t>& latencies = total.latencies[op];
+
+        if(latencies.empty()) {
+            continue;
+        }
+
+        sort(latencies.begin(), latencies.end());
+
+        printf("%-10s %10lu %10.1f %7.2f%% %10u %10u %10u %10u\n", op_names[op],
+            static_cast<unsigned long>(latencies.size()), elapsed > 0.0 ? latencies.size() / elapsed : 0.0,
+            total.failures[op] * 100.0 / latencies.size(),
+            percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99),
+            latencies.back());
+    }
+
+    sort(total.lags.begin(), total.lags.end());
+
+    printf("\ncalls: %lu in %.2fs, lag p50: %uus, p99: %uus, max: %uus\n",
+        static_cast<unsigned long>(calls.size()), elapsed,
+        percentile(total.lags, 0.5), percentile(total.lags, 0.99), total.lags.back());
+
+    return EXIT_SUCCESS;
+}